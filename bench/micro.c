@@ -0,0 +1,475 @@
+// Microbenchmarks for the building blocks of a hash step, each timed in
+// isolation:
+//   - hashes on 12-byte keys (fnv1a64 and alternatives)
+//   - key equality (memcmp, as used by every engine)
+//   - newline scanning (memchr and every kernel level this CPU supports)
+//   - linear-probe lookups at fixed load factors, in and out of cache
+//   - uncontended acquire/release per locking scheme
+//   - key allocation strategies used or considered by the engines
+// Every benchmark is run BENCH_REPEATS times for at least BENCH_MIN_NS and
+// the fastest run is reported, as ns/op and TSC cycles/op.
+//
+// Usage: micro [--filter <substring>]
+
+#define HW2_NO_MAIN
+#include "../src/main.c"
+
+#define KEY_LENGTH 12
+#define BENCH_KEYS 4096            // working set of keys for hash/compare benchmarks
+#define BENCH_MIN_NS 20000000LL    // 20 ms per timed run
+#define BENCH_REPEATS 3
+#define BENCH_ALLOC_BATCH 4096     // allocations per batch before freeing them
+
+static const char *bench_filter = NULL;
+static volatile uint64_t bench_sink;  // keeps results observable
+
+static inline uint64_t read_cycles(void) {
+#ifdef HW2_X86
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// A benchmark body performs ops operations and returns a value to sink
+typedef uint64_t (*BenchFn)(void *ctx, size_t ops);
+
+static void bench_run(const char *name, BenchFn fn, void *ctx) {
+    if (bench_filter && !strstr(name, bench_filter)) return;
+
+    // Calibrate the op count so one run takes at least BENCH_MIN_NS
+    size_t ops = 1024;
+    while (1) {
+        long long t0 = now_ns();
+        bench_sink += fn(ctx, ops);
+        if (now_ns() - t0 >= BENCH_MIN_NS / 4 || ops >= ((size_t)1 << 34)) break;
+        ops *= 2;
+    }
+    ops *= 4;
+
+    double best_ns = 0.0, best_cycles = 0.0;
+    for (int r = 0; r < BENCH_REPEATS; r++) {
+        long long t0 = now_ns();
+        uint64_t c0 = read_cycles();
+        bench_sink += fn(ctx, ops);
+        uint64_t c1 = read_cycles();
+        long long t1 = now_ns();
+
+        double ns = (double)(t1 - t0) / (double)ops;
+        if (r == 0 || ns < best_ns) {
+            best_ns = ns;
+            best_cycles = (double)(c1 - c0) / (double)ops;
+        }
+    }
+    printf("%-44s %9.2f ns/op %9.1f cycles/op\n", name, best_ns, best_cycles);
+}
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+// count random alphanumeric keys of KEY_LENGTH bytes, NUL separated
+static char *make_keys(size_t count) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789";
+    char *keys = (char *)malloc(count * (KEY_LENGTH + 1));
+    if (!keys) {
+        perror("Memory allocation failed for keys");
+        exit(1);
+    }
+    for (size_t i = 0; i < count; i++) {
+        for (int j = 0; j < KEY_LENGTH; j++) keys[i * (KEY_LENGTH + 1) + j] = alphabet[rng_next() % 62];
+        keys[i * (KEY_LENGTH + 1) + KEY_LENGTH] = '\0';
+    }
+    return keys;
+}
+
+#define KEY_AT(keys, i) ((keys) + (size_t)(i) * (KEY_LENGTH + 1))
+
+// ------------------------------------------------------------------------
+// Hashes
+
+typedef struct {
+    const char *keys;
+    uint64_t (*hash)(const char *data, size_t len);
+} HashCtx;
+
+static uint64_t hash_fnv1a64(const char *data, size_t len) {
+    return fnv1a64(data, len);
+}
+
+static uint64_t hash_fnv1a64_mix(const char *data, size_t len) {
+    return mix64(fnv1a64(data, len));
+}
+
+// Two overlapping word loads folded with one 64x64->128 multiply (8..16 bytes)
+static uint64_t hash_mulfold(const char *data, size_t len) {
+    uint64_t a, b;
+    memcpy(&a, data, 8);
+    memcpy(&b, data + len - 8, 8);
+    unsigned __int128 m = (unsigned __int128)(a ^ 0xa0761d6478bd642fULL) * (b ^ 0xe7037ed1a0b428dbULL ^ len);
+    return (uint64_t)m ^ (uint64_t)(m >> 64);
+}
+
+#ifdef HW2_X86
+__attribute__((target("sse4.2")))
+static uint64_t hash_crc32c(const char *data, size_t len) {
+    uint64_t a, b;
+    memcpy(&a, data, 8);
+    memcpy(&b, data + len - 8, 8);
+    uint64_t h = _mm_crc32_u64(0, a);
+    return (h << 32) | _mm_crc32_u64(h ^ len, b);
+}
+#endif
+
+static uint64_t bench_hash(void *ctx, size_t ops) {
+    HashCtx *hc = (HashCtx *)ctx;
+    uint64_t acc = 0;
+    for (size_t i = 0; i < ops; i++) {
+        acc += hc->hash(KEY_AT(hc->keys, i & (BENCH_KEYS - 1)), KEY_LENGTH);
+    }
+    return acc;
+}
+
+// ------------------------------------------------------------------------
+// Key equality: every comparison is against an equal copy (the common
+// outcome for the final probe of a hit)
+
+typedef struct {
+    const char *keys;
+    const char *copies;
+    int (*equal)(const char *a, const char *b, size_t len);
+} EqualCtx;
+
+static int equal_memcmp(const char *a, const char *b, size_t len) {
+    return memcmp(a, b, len) == 0;
+}
+
+static uint64_t bench_equal(void *ctx, size_t ops) {
+    EqualCtx *ec = (EqualCtx *)ctx;
+    uint64_t acc = 0;
+    for (size_t i = 0; i < ops; i++) {
+        size_t k = i & (BENCH_KEYS - 1);
+        acc += (uint64_t)ec->equal(KEY_AT(ec->keys, k), KEY_AT(ec->copies, k), KEY_LENGTH);
+    }
+    return acc;
+}
+
+// ------------------------------------------------------------------------
+// Newline scanning: find the end of each line of a buffer of newline
+// separated keys, as the chunked readers' indexer does
+
+typedef struct {
+    const char *text;
+    size_t length;
+    const char *(*scan)(const char *p, size_t n);
+} ScanCtx;
+
+static uint64_t bench_scan(void *ctx, size_t ops) {
+    ScanCtx *sc = (ScanCtx *)ctx;
+    uint64_t acc = 0;
+    size_t at = 0;
+    for (size_t i = 0; i < ops; i++) {
+        const char *nl = sc->scan(sc->text + at, sc->length - at);
+        at = (size_t)(nl - sc->text) + 1;
+        if (at >= sc->length) at = 0;
+        acc += at;
+    }
+    return acc;
+}
+
+// ------------------------------------------------------------------------
+// Probe loops: serial lookups of present keys in a HashEntry table filled
+// to a fixed load factor, the same probe sequence as the lock engine minus
+// the locks
+
+typedef struct {
+    HashEntry *table;
+    size_t size;
+    StringMetadata *meta;
+    size_t count;
+} ProbeCtx;
+
+static int probe_build(ProbeCtx *pc, size_t slots, double load) {
+    pc->size = slots;
+    pc->count = (size_t)((double)slots * load);
+    pc->table = (HashEntry *)calloc(slots, sizeof(HashEntry));
+    pc->meta = (StringMetadata *)malloc(pc->count * sizeof(StringMetadata));
+    char *keys = make_keys(pc->count);
+    if (!pc->table || !pc->meta) {
+        perror("Memory allocation failed for probe table");
+        return 1;
+    }
+
+    for (size_t i = 0; i < pc->count; i++) {
+        pc->meta[i].ptr = KEY_AT(keys, i);
+        pc->meta[i].length = KEY_LENGTH;
+        size_t pos = fnv1a64(pc->meta[i].ptr, KEY_LENGTH) % slots;
+        while (pc->table[pos].key) pos = (pos + 1) % slots;
+        pc->table[pos].key = &pc->meta[i];
+    }
+    return 0;
+}
+
+static void probe_free(ProbeCtx *pc) {
+    if (pc->count) free(pc->meta[0].ptr);
+    free(pc->meta);
+    free(pc->table);
+}
+
+static uint64_t bench_probe(void *ctx, size_t ops) {
+    ProbeCtx *pc = (ProbeCtx *)ctx;
+    uint64_t acc = 0;
+    size_t k = 0;
+    for (size_t i = 0; i < ops; i++) {
+        k = (k + 0x9E3779B1u) % pc->count;  // scattered order defeats prefetching of neighbours
+        const StringMetadata *key = &pc->meta[k];
+        size_t pos = fnv1a64(key->ptr, key->length) % pc->size;
+        while (1) {
+            const HashEntry *e = &pc->table[pos];
+            if (!e->key) break;
+            if (e->key->length == key->length && memcmp(e->key->ptr, key->ptr, key->length) == 0) {
+                acc += pos;
+                break;
+            }
+            pos = (pos + 1) % pc->size;
+        }
+    }
+    return acc;
+}
+
+// ------------------------------------------------------------------------
+// Locks, uncontended
+
+static pthread_mutex_t bench_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_spinlock_t bench_spin;
+static atomic_flag bench_flag = ATOMIC_FLAG_INIT;
+static _Atomic uint64_t bench_counter = 0;
+
+static uint64_t bench_lock_mutex(void *ctx, size_t ops) {
+    (void)ctx;
+    for (size_t i = 0; i < ops; i++) {
+        pthread_mutex_lock(&bench_mutex);
+        pthread_mutex_unlock(&bench_mutex);
+    }
+    return ops;
+}
+
+static uint64_t bench_lock_spin(void *ctx, size_t ops) {
+    (void)ctx;
+    for (size_t i = 0; i < ops; i++) {
+        pthread_spin_lock(&bench_spin);
+        pthread_spin_unlock(&bench_spin);
+    }
+    return ops;
+}
+
+static uint64_t bench_lock_flag(void *ctx, size_t ops) {
+    (void)ctx;
+    for (size_t i = 0; i < ops; i++) {
+        while (atomic_flag_test_and_set_explicit(&bench_flag, memory_order_acquire)) {
+        }
+        atomic_flag_clear_explicit(&bench_flag, memory_order_release);
+    }
+    return ops;
+}
+
+static uint64_t bench_fetch_add(void *ctx, size_t ops) {
+    (void)ctx;
+    for (size_t i = 0; i < ops; i++) atomic_fetch_add(&bench_counter, 1);
+    return atomic_load(&bench_counter);
+}
+
+// ------------------------------------------------------------------------
+// Key allocation, in batches that are then released, so each op includes
+// its share of the free
+
+typedef struct {
+    const char *keys;
+    StringMetadata *slots[BENCH_ALLOC_BATCH];
+    char *arena;
+    StringMetadata *arena_meta;
+} AllocCtx;
+
+// Lock engine: StringMetadata and key bytes as two mallocs
+static uint64_t bench_alloc_two(void *ctx, size_t ops) {
+    AllocCtx *ac = (AllocCtx *)ctx;
+    for (size_t done = 0; done < ops; done += BENCH_ALLOC_BATCH) {
+        for (size_t i = 0; i < BENCH_ALLOC_BATCH; i++) {
+            StringMetadata *m = malloc(sizeof(StringMetadata));
+            m->ptr = malloc(KEY_LENGTH + 1);
+            memcpy(m->ptr, KEY_AT(ac->keys, i), KEY_LENGTH + 1);
+            m->length = KEY_LENGTH;
+            ac->slots[i] = m;
+        }
+        for (size_t i = 0; i < BENCH_ALLOC_BATCH; i++) {
+            free(ac->slots[i]->ptr);
+            free(ac->slots[i]);
+        }
+    }
+    return (uint64_t)(uintptr_t)ac->slots[0];
+}
+
+// One malloc holding StringMetadata followed by the bytes
+static uint64_t bench_alloc_one(void *ctx, size_t ops) {
+    AllocCtx *ac = (AllocCtx *)ctx;
+    for (size_t done = 0; done < ops; done += BENCH_ALLOC_BATCH) {
+        for (size_t i = 0; i < BENCH_ALLOC_BATCH; i++) {
+            StringMetadata *m = malloc(sizeof(StringMetadata) + KEY_LENGTH + 1);
+            m->ptr = (char *)(m + 1);
+            memcpy(m->ptr, KEY_AT(ac->keys, i), KEY_LENGTH + 1);
+            m->length = KEY_LENGTH;
+            ac->slots[i] = m;
+        }
+        for (size_t i = 0; i < BENCH_ALLOC_BATCH; i++) free(ac->slots[i]);
+    }
+    return (uint64_t)(uintptr_t)ac->slots[0];
+}
+
+// Bump arena as in the split engine: copy bytes, reset per batch
+static uint64_t bench_alloc_arena(void *ctx, size_t ops) {
+    AllocCtx *ac = (AllocCtx *)ctx;
+    uint64_t acc = 0;
+    for (size_t done = 0; done < ops; done += BENCH_ALLOC_BATCH) {
+        char *cursor = ac->arena;
+        for (size_t i = 0; i < BENCH_ALLOC_BATCH; i++) {
+            memcpy(cursor, KEY_AT(ac->keys, i), KEY_LENGTH + 1);
+            ac->arena_meta[i].ptr = cursor;
+            ac->arena_meta[i].length = KEY_LENGTH;
+            cursor += KEY_LENGTH + 1;
+        }
+        acc += (uint64_t)(unsigned char)ac->arena[done & 7];
+    }
+    return acc;
+}
+
+// --zero_copy: the table just points at the input's StringMetadata
+static uint64_t bench_alloc_zero_copy(void *ctx, size_t ops) {
+    AllocCtx *ac = (AllocCtx *)ctx;
+    for (size_t done = 0; done < ops; done += BENCH_ALLOC_BATCH) {
+        for (size_t i = 0; i < BENCH_ALLOC_BATCH; i++) ac->slots[i] = &ac->arena_meta[i];
+        __asm__ volatile("" : : "r"(ac->slots) : "memory");
+    }
+    return (uint64_t)(uintptr_t)ac->slots[BENCH_ALLOC_BATCH - 1];
+}
+
+// ------------------------------------------------------------------------
+
+static int parse_bench_arguments(int argc, char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            bench_filter = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [--filter <substring>]\n", argv[0]);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (parse_bench_arguments(argc, argv) != 0) return 1;
+    if (select_kernels("auto") != 0) return 1;
+    printf("Kernels: %s, key length %d\n", g_kernels.isa, KEY_LENGTH);
+
+    char *keys = make_keys(BENCH_KEYS);
+    char *copies = (char *)malloc(BENCH_KEYS * (KEY_LENGTH + 1));
+    if (!copies) {
+        perror("Memory allocation failed for keys");
+        return 1;
+    }
+    memcpy(copies, keys, BENCH_KEYS * (KEY_LENGTH + 1));
+
+    // Hashes
+    HashCtx hc = { keys, hash_fnv1a64 };
+    bench_run("hash fnv1a64", bench_hash, &hc);
+    hc.hash = hash_fnv1a64_mix;
+    bench_run("hash fnv1a64+mix64", bench_hash, &hc);
+    hc.hash = hash_mulfold;
+    bench_run("hash mulfold (2 loads, 128-bit multiply)", bench_hash, &hc);
+#ifdef HW2_X86
+    if (__builtin_cpu_supports("sse4.2")) {
+        hc.hash = hash_crc32c;
+        bench_run("hash crc32c (2 x _mm_crc32_u64)", bench_hash, &hc);
+    }
+#endif
+
+    // Key equality
+    EqualCtx ec = { keys, copies, equal_memcmp };
+    bench_run("equal memcmp", bench_equal, &ec);
+
+    // Newline scanning over the keys as one newline-separated text
+    char *text = (char *)malloc(BENCH_KEYS * (KEY_LENGTH + 1));
+    if (!text) {
+        perror("Memory allocation failed for text");
+        return 1;
+    }
+    memcpy(text, keys, BENCH_KEYS * (KEY_LENGTH + 1));
+    for (size_t i = 0; i < BENCH_KEYS; i++) text[i * (KEY_LENGTH + 1) + KEY_LENGTH] = '\n';
+    ScanCtx sc = { text, BENCH_KEYS * (KEY_LENGTH + 1), NULL };
+    for (size_t i = 0; i < NUM_KERNEL_SETS; i++) {
+        if (!g_kernel_sets[i].supported()) continue;
+        char name[64];
+        snprintf(name, sizeof(name), "scan newline %s", g_kernel_sets[i].isa);
+        sc.scan = g_kernel_sets[i].scan_newline;
+        bench_run(name, bench_scan, &sc);
+    }
+
+    // Probe loops: 4096 slots (64 KB, cache resident) and 4M slots (64 MB)
+    static const size_t probe_slots[] = { (size_t)1 << 12, (size_t)1 << 22 };
+    static const double probe_loads[] = { 0.25, 0.5, 0.75, 0.9 };
+    for (size_t s = 0; s < sizeof(probe_slots) / sizeof(probe_slots[0]); s++) {
+        for (size_t l = 0; l < sizeof(probe_loads) / sizeof(probe_loads[0]); l++) {
+            char name[64];
+            snprintf(name, sizeof(name), "probe hit %s load %.2f",
+                     s == 0 ? "in-cache" : "out-of-cache", probe_loads[l]);
+            if (bench_filter && !strstr(name, bench_filter)) continue;
+            ProbeCtx pc;
+            if (probe_build(&pc, probe_slots[s], probe_loads[l]) != 0) return 1;
+            bench_run(name, bench_probe, &pc);
+            probe_free(&pc);
+        }
+    }
+
+    // Locks
+    pthread_spin_init(&bench_spin, PTHREAD_PROCESS_PRIVATE);
+    bench_run("lock pthread_mutex", bench_lock_mutex, NULL);
+    bench_run("lock pthread_spin", bench_lock_spin, NULL);
+    bench_run("lock atomic_flag spin", bench_lock_flag, NULL);
+    bench_run("atomic fetch_add (reference)", bench_fetch_add, NULL);
+    pthread_spin_destroy(&bench_spin);
+
+    // Key allocation
+    AllocCtx *ac = (AllocCtx *)calloc(1, sizeof(AllocCtx));
+    if (ac) {
+        ac->arena = (char *)malloc(BENCH_ALLOC_BATCH * (KEY_LENGTH + 1));
+        ac->arena_meta = (StringMetadata *)malloc(BENCH_ALLOC_BATCH * sizeof(StringMetadata));
+    }
+    if (!ac || !ac->arena || !ac->arena_meta) {
+        perror("Memory allocation failed for allocation benchmarks");
+        return 1;
+    }
+    ac->keys = keys;
+    bench_run("alloc malloc x2 (lock engine)", bench_alloc_two, ac);
+    bench_run("alloc malloc x1 (metadata+bytes)", bench_alloc_one, ac);
+    bench_run("alloc bump arena (split engine)", bench_alloc_arena, ac);
+    bench_run("alloc none (--zero_copy)", bench_alloc_zero_copy, ac);
+    free(ac->arena);
+    free(ac->arena_meta);
+    free(ac);
+
+    free(keys);
+    free(copies);
+    free(text);
+    return 0;
+}
@@ -2,6 +2,7 @@
 import os
 import re
 import glob
+import math
 import numpy as np
 import matplotlib.pyplot as plt
 from collections import defaultdict
@@ -17,6 +18,21 @@ FNAME_RE = re.compile(
 )
 
 # --- PARSE ALL RESULTS INTO MEMORY --------------------------------------
+def read_totals(path):
+    """Sum ExecutionTime (ms) and NumberOfHandledCollision over all steps."""
+    total_time = 0.0
+    total_coll = 0.0
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if line.startswith("ExecutionTime:"):
+                parts = line.split()
+                total_time += float(parts[-2])
+            elif line.startswith("NumberOfHandledCollision:"):
+                parts = line.split()
+                total_coll += float(parts[-1])
+    return total_time, total_coll
+
 # data[(ds,ts)][threads] -> { "time": ms, "coll": count }
 data = defaultdict(lambda: defaultdict(lambda: {"time": 0.0, "coll": 0.0}))
 
@@ -30,18 +46,7 @@ for path in glob.glob(os.path.join(RESULTS_DIR, "*.txt")):
     ts = int(m.group("tsize"))     # e.g. 90
     th = int(m.group("threads"))   # e.g. 512
 
-    total_time = 0.0
-    total_coll = 0.0
-    with open(path) as f:
-        for line in f:
-            line = line.strip()
-            if line.startswith("ExecutionTime:"):
-                parts = line.split()
-                total_time += float(parts[-2])
-            elif line.startswith("NumberOfHandledCollision:"):
-                parts = line.split()
-                total_coll += float(parts[-1])
-
+    total_time, total_coll = read_totals(path)
     data[(ds, ts)][th]["time"] = total_time
     data[(ds, ts)][th]["coll"] = total_coll
 
@@ -170,4 +175,115 @@ for ds, ts_dict in sorted(by_ds.items()):
     fig.savefig(outpath, dpi=150)
     plt.close(fig)
 
+# --- 3) Scaling analysis: speedup, efficiency, Amdahl and USL ----------
+# Every run does the same work, so throughput is proportional to 1/time and
+# speedup S(N) = T(1) / T(N). Results of "make engine-compare" live in
+# results/<engine>/; files directly under results/ count as engine "default".
+#   Amdahl: S(N) = 1 / ((1 - p) + p / N)
+#   USL:    S(N) = N / (1 + sigma (N - 1) + kappa N (N - 1)),
+#           peaking at N* = sqrt((1 - sigma) / kappa)
+def fit_amdahl(ns, speedups):
+    """Parallel fraction p from 1 - 1/S = p (1 - 1/N), least squares."""
+    xs = [1.0 - 1.0 / n for n in ns]
+    ys = [1.0 - 1.0 / s for s in speedups]
+    den = sum(x * x for x in xs)
+    p = sum(x * y for x, y in zip(xs, ys)) / den if den else 0.0
+    return min(max(p, 0.0), 1.0)
+
+def fit_usl(ns, speedups):
+    """(sigma, kappa) from N/S - 1 = sigma (N-1) + kappa N (N-1), sigma in
+    [0, 1] and kappa >= 0."""
+    x1 = [n - 1.0 for n in ns]
+    x2 = [n * (n - 1.0) for n in ns]
+    y = [n / s - 1.0 for n, s in zip(ns, speedups)]
+    a11 = sum(a * a for a in x1)
+    a12 = sum(a * b for a, b in zip(x1, x2))
+    a22 = sum(b * b for b in x2)
+    b1 = sum(a * c for a, c in zip(x1, y))
+    b2 = sum(b * c for b, c in zip(x2, y))
+    det = a11 * a22 - a12 * a12
+    sigma = (b1 * a22 - b2 * a12) / det if det else 0.0
+    kappa = (a11 * b2 - a12 * b1) / det if det else 0.0
+    # Refit with one coefficient pinned at zero when the joint fit goes negative
+    if kappa < 0.0:
+        kappa = 0.0
+        sigma = b1 / a11 if a11 else 0.0
+    if sigma < 0.0:
+        sigma = 0.0
+        kappa = max(b2 / a22, 0.0) if a22 else 0.0
+    return min(sigma, 1.0), kappa
+
+def usl_peak(sigma, kappa):
+    """Thread count of maximum USL throughput (inf if it never turns down)."""
+    if kappa > 0.0:
+        return max(math.sqrt((1.0 - sigma) / kappa), 1.0)
+    return float("inf") if sigma < 1.0 else 1.0
+
+def amdahl(n, p):
+    return 1.0 / ((1.0 - p) + p / n)
+
+def usl(n, sigma, kappa):
+    return n / (1.0 + sigma * (n - 1.0) + kappa * n * (n - 1.0))
+
+# runs[(engine, ds, ts)][threads] -> total ms
+runs = defaultdict(dict)
+for path in glob.glob(os.path.join(RESULTS_DIR, "*.txt")) + \
+            glob.glob(os.path.join(RESULTS_DIR, "*", "*.txt")):
+    m = FNAME_RE.match(os.path.basename(path))
+    if not m:
+        continue
+    parent = os.path.basename(os.path.dirname(path))
+    engine = "default" if os.path.samefile(os.path.dirname(path), RESULTS_DIR) else parent
+    total_time, _ = read_totals(path)
+    key = (engine, int(m.group("data")), int(m.group("tsize")))
+    runs[key][int(m.group("threads"))] = total_time
+
+summary_rows = []
+for (engine, ds, ts), by_threads in sorted(runs.items()):
+    base = by_threads.get(1)
+    if not base:
+        print(f"{engine} {ds}K/{ts}K: no 1-thread run, skipping scaling analysis")
+        continue
+    # Runs too short to time (0 ms) cannot be compared
+    ns = [n for n in sorted(by_threads) if by_threads[n] > 0]
+    speedups = [base / by_threads[n] for n in ns]
+    p = fit_amdahl(ns, speedups)
+    sigma, kappa = fit_usl(ns, speedups)
+    peak_n = max(ns, key=lambda n: base / by_threads[n])
+    peak_usl = usl_peak(sigma, kappa)
+
+    print(f"\nScaling {engine} data {ds}K table {ts}K:")
+    print(f"  {'threads':>7} {'ms':>9} {'speedup':>8} {'efficiency':>10}")
+    for n, sp in zip(ns, speedups):
+        mark = "  <- peak" if n == peak_n else ""
+        print(f"  {n:>7} {by_threads[n]:>9.0f} {sp:>8.2f} {sp / n:>10.2f}{mark}")
+    print(f"  Amdahl p = {p:.3f} (max speedup {1.0 / (1.0 - p) if p < 1.0 else float('inf'):.1f})")
+    print(f"  USL sigma = {sigma:.4f}, kappa = {kappa:.6f}, predicted peak N* = {peak_usl:.1f}")
+    summary_rows.append((engine, ds, ts, peak_n, base / by_threads[peak_n], p, sigma, kappa, peak_usl))
+
+    # Speedup plot: measured, ideal, and both fits
+    fig, ax = plt.subplots(figsize=(8, 4))
+    grid = np.logspace(0, math.log10(max(ns)), 200)
+    ax.plot(ns, speedups, "o", color="black", label="measured")
+    ax.plot(grid, grid, ":", color="gray", label="ideal")
+    ax.plot(grid, [amdahl(n, p) for n in grid], "-", label=f"Amdahl p={p:.3f}")
+    ax.plot(grid, [usl(n, sigma, kappa) for n in grid], "--",
+            label=f"USL \u03c3={sigma:.3f} \u03ba={kappa:.5f}")
+    ax.axvline(peak_n, color="red", alpha=0.4, label=f"peak {peak_n} threads")
+    ax.set_xscale("log", base=2)
+    ax.set_ylim(0, max(max(speedups) * 1.3, 1.5))
+    ax.set_xlabel("Number of Threads")
+    ax.set_ylabel("Speedup vs 1 thread")
+    ax.set_title(f"Scaling: {engine}, Dataset {ds}K, Table Size {ts}K")
+    ax.legend(fontsize=8)
+    plt.tight_layout()
+    fig.savefig(os.path.join(PLOTS_DIR, f"scaling_{engine}_{ds}K_{ts}K.png"), dpi=150)
+    plt.close(fig)
+
+if summary_rows:
+    with open(os.path.join(PLOTS_DIR, "scaling_summary.csv"), "w") as f:
+        f.write("engine,data_k,tsize_k,peak_threads,peak_speedup,amdahl_p,usl_sigma,usl_kappa,usl_peak_threads\n")
+        for row in summary_rows:
+            f.write("%s,%d,%d,%d,%.3f,%.4f,%.5f,%.7f,%.1f\n" % row)
+
 print(f"Done! Plots saved under ./{PLOTS_DIR}/")
@@ -1,11 +1,34 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include <errno.h>
 #include <time.h>
+#include <math.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sched.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <dlfcn.h>
+#include <elf.h>
+#include <zlib.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HW2_X86 1
+#endif
 
 #define MAX_OPERATIONS 16
+#define SET_MAX_TABLES (2 * MAX_OPERATIONS)  // named tables: one per set-action operand
 
 typedef struct {
     char *action[MAX_OPERATIONS];
@@ -14,6 +37,30 @@ typedef struct {
     size_t data_size;
     int threads;
     size_t tsize;
+    const char *engine;        // hash engine name (see g_engines)
+    const char *presize;       // NULL, "data_size" or "hll": choose capacity from target_load
+    double target_load;        // load factor aimed for by --presize
+    double shrink_below;       // >0 -> rebuild smaller when live load drops below this
+    const char *reader;        // input reader: "stdio" (fgets), "uring" or "pread"
+    long cache_mb;             // dataset cache cap in MB, <0 unlimited, 0 disables
+    int compress_results;      // 1 -> write results as parallel multi-member gzip
+    long progress_ms;          // >0 -> sample progress every N ms to stderr
+    const char *metrics_file;  // optional Prometheus textfile output
+    const char *results_dir;   // directory for Results_*.txt files
+    const char *isa;           // "auto" or a kernel level forced for benchmarking
+    int zero_copy;             // 1 -> table keys reference dataset buffers instead of copies
+    int analyze;               // 1 -> report hash distribution and clustering after each step
+    int calibrate;             // 1 -> measure memory ceilings, report each step against them
+    double fpr;                // false-positive rate of the cuckoo filter engine
+    const char *disk_file;     // backing file of the disk engine, NULL -> <results_dir>/disk_table.bin
+    size_t hot_cache;          // per-thread hot-key cache entries of the lock engine, 0 -> off
+    const char *profile_file;  // folded stacks from the SIGPROF sampler, NULL -> off
+    int profile_hz;            // sampler rate per thread of CPU time
+    const char *table_name[SET_MAX_TABLES];  // --table <name> <file> for set actions
+    const char *table_file[SET_MAX_TABLES];
+    int num_tables;
+    size_t topk;               // keys reported by the topk action
+    size_t sketch_counters;    // Space-Saving counters per thread for topk
 } ProgramArgs;
 
 typedef struct {
@@ -25,8 +72,150 @@ typedef struct {
 typedef struct {
     StringMetadata *key;  // NULL -> empty, non-NULL -> valid key
     uint8_t tombstone;    // 1 -> deleted (tombstone), 0 -> valid/empty
+    uint8_t source;       // 0 -> key owned by the table, else zero-copy source id + 1
 } HashEntry;
 
+// A loaded input file, kept resident across flow steps by the dataset cache.
+// Identified by path plus device/inode/mtime/size so edited files reload.
+typedef struct {
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    off_t file_size;
+    size_t lineCount;
+    StringMetadata *metadata;
+    char *data;
+    size_t bytes;              // memory held by metadata + data
+    unsigned long last_used;   // LRU clock value
+    int cached;                // 0 -> transient, freed by release_dataset()
+    int pooled;                // metadata/data borrowed from the buffer pool
+    int source;                // zero-copy key source id + 1 holding metadata/data, 0 -> none
+    const char *scan;          // line splitter that ran: "fgets" or a scan_newline kernel
+} Dataset;
+
+// Per-thread progress counters, published by workers and sampled by the reporter.
+// Aligned to a cache line (pool buffers are line-aligned) so workers never share a line.
+typedef struct {
+    _Alignas(64) _Atomic size_t keys_done;
+    _Atomic size_t collisions;
+    _Atomic long long live_delta;  // keys added minus keys removed in this step
+} ThreadProgress;
+
+// How often (in keys) a worker publishes its counters
+#define PROGRESS_PUBLISH_INTERVAL 256
+
+// Shrink policy: a table whose live load drops below --shrink_below is
+// rebuilt at twice that load; a shrunk table is grown back (never beyond
+// --tsize) before an insert step could push it above RESIZE_GROW_LOAD.
+// The gap between the two keeps steps from oscillating.
+#define RESIZE_GROW_LOAD 0.75
+#define RESIZE_MIN_SLOTS 1024
+
+// Delegation engine: the table is split into partitions owned by threads;
+// other threads hand operations to the owner through SPSC rings
+#define DELEGATE_MAX_PARTITIONS 64
+#define DELEGATE_MIN_PARTITION_SLOTS 1024
+#define DELEGATE_RING_SIZE 128      // entries per (producer, owner) ring, power of two
+#define DELEGATE_DRAIN_INTERVAL 64  // owners drain their rings every N own keys
+
+// Split-ordered chaining engine
+#define SPLIT_INITIAL_BUCKETS 1024
+#define SPLIT_MAX_LOAD 2            // double the buckets above this many keys per bucket
+#define SPLIT_SEGMENTS 48           // bucket directory segments (segment s holds 2^s buckets)
+#define SPLIT_CHUNK_NODES 4096      // nodes per arena chunk
+#define SPLIT_CHUNK_BYTES (64u << 10)  // key bytes per arena chunk
+#define SPLIT_COUNT_FLUSH 64        // flush thread-local key counts every N changes
+
+// Hot-key cache (--hot_cache)
+#define HOT_KEY_MAX 22              // longest key the per-thread hot-key cache copies inline
+
+// Cuckoo filter engine
+#define CUCKOO_SLOTS 4              // fingerprints per bucket
+#define CUCKOO_LOAD 0.9             // buckets are sized for this load at --tsize keys
+#define CUCKOO_DEFAULT_FPR 0.003    // about 12-bit fingerprints
+#define CUCKOO_LOCK_STRIPES 8192    // bucket lock stripes, power of two
+#define CUCKOO_MAX_KICKS 500        // longest eviction path searched
+#define CUCKOO_PATH_RETRIES 16      // path searches before an insert gives up
+
+// Disk engine
+#define DISK_PAGE 4096              // bytes per bucket page
+#define DISK_KEYS_PER_PAGE 64       // --tsize slots per page: 12-byte keys fill pages about a quarter
+#define DISK_MAX_SLOTS 1024         // directory entries per page; index = page * DISK_MAX_SLOTS + slot
+#define DISK_SPARE_PAGES 16         // overflow pages past the last home page
+
+// HyperLogLog distinct-key estimator used by --presize hll
+#define HLL_PRECISION 14
+#define HLL_REGISTERS (1u << HLL_PRECISION)
+#define DEFAULT_TARGET_LOAD 0.5
+
+// Chunked input reader (--reader uring/pread)
+#define READ_CHUNK_SIZE (1u << 20)
+#define URING_QUEUE_DEPTH 8
+
+// Zero-copy keys (--zero_copy)
+#define KEY_SOURCE_MAX MAX_OPERATIONS  // at most one new source per flow step
+#define KEY_SOURCE_ROW 24              // per-thread delta row, padded to whole cache lines
+#define KEY_SOURCE_COMPACT 0.25        // compact released sources below this live fraction
+
+// Table analysis (--analyze)
+#define ANALYZE_REGIONS 16
+#define ANALYZE_MAX_BINS 4096         // chi-squared bins over home slots
+#define ANALYZE_MIN_EXPECTED 10       // keys expected per chi-squared bin
+#define ANALYZE_CLUSTER_CLASSES 24    // cluster histogram classes: 1, 2, 3-4, 5-8, ...
+
+// Machine calibration (--calibrate)
+#define CALIBRATE_SEQ_BYTES (64u << 20)     // buffer streamed for sequential bandwidth
+#define CALIBRATE_SEQ_PASSES 4
+#define CALIBRATE_LINE 64                   // pointer-chase node size (one cache line)
+#define CALIBRATE_MIN_FOOTPRINT (1u << 20)
+#define CALIBRATE_KEY_BYTES 32              // per-key allocation guess: key text plus malloc overhead
+#define CALIBRATE_CHASE_STEPS (4u << 20)    // dependent loads timed for latency
+#define CALIBRATE_CHAINS 8                  // independent chases per thread (memory-level parallelism)
+#define CALIBRATE_MAX_THREADS 64
+
+// Frozen minimal perfect hash index (freeze / lookup actions)
+#define FREEZE_PARTITION_KEYS 8192    // average keys per independently built partition
+#define FREEZE_BUCKET_C 4.0           // buckets per partition: c * n / log2(n)
+#define FREEZE_ALPHA 0.98             // keys / positions before remapping
+#define FREEZE_SKEW 0.6               // fraction of keys sent to the skewed buckets
+#define FREEZE_SKEW_BUCKETS 0.3       // fraction of buckets that receive them
+#define FREEZE_PILOTS 65536           // pilot values tried per bucket (16-bit pilots)
+#define FREEZE_SEEDS 32               // seeds tried per partition before giving up
+
+// Gzip input/output
+#define GZIP_BLOCK_SIZE (1u << 20)  // uncompressed bytes per output gzip member
+#define GZIP_LEVEL 6
+#define GZIP_GUESS_RATIO 4          // input buffer guess: compressed size times this
+#define GZIP_ISIZE_MAX_RATIO 32     // ISIZE trailers implying more are not trusted
+
+// Heavy hitters (topk action)
+#define HH_DEFAULT_K 10
+#define HH_DEFAULT_COUNTERS 4096    // Space-Saving counters per thread
+#define HH_MIN_RANGE_BYTES (64u << 10)  // input bytes per thread at least
+
+// Sampling profiler (--profile)
+#define PROF_DEFAULT_HZ 999         // odd rate so sampling does not beat with periodic work
+#define PROF_MAX_SAMPLES 16384      // per thread, further samples are counted as dropped
+#define PROF_STACK_DEPTH 16         // IP plus return addresses kept per sample
+
+// Background progress reporter state for one flow step
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int stop;
+    const ProgramArgs *args;
+    int op_index;
+    const char *action;
+    size_t total_keys;
+    ThreadProgress *slots;
+    int nthreads;
+    struct timespec step_start;
+    struct timespec last_sample;
+    size_t last_done;
+} ProgressReporter;
+
 // Worker thread arguments
 typedef struct {
     size_t start;             // inclusive
@@ -35,25 +224,122 @@ typedef struct {
     size_t *out_indices;      // per-line output indices
     char *out_results;        // per-line output results (T/F)
     size_t *collision_count;  // per-thread collision count
+    ThreadProgress *progress; // live counters for the progress reporter
     const char *action;       // "insert" or "delete"
+    int thread_id;            // 0..nthreads-1
+    int nthreads;             // threads in this step
+    int key_source;           // zero-copy source id + 1 that meta belongs to, 0 -> copy keys
+    long long *source_refs;   // per-source key reference deltas of this thread
 } WorkerArgs;
 
+// Callback used to enumerate the live keys of an engine
+typedef void (*KeyVisitor)(const char *key, size_t length, size_t slot, void *ctx);
+
+// A concurrent hash engine. Every engine runs a flow step as nthreads copies
+// of its worker over disjoint [start, end) ranges of WorkerArgs and reports
+// per-line indices/results the same way.
+typedef struct {
+    const char *name;
+    int (*ensure)(size_t size);                    // allocate on first use
+    void *(*worker)(void *arg);                    // thread body over WorkerArgs
+    void (*cleanup)(void);                         // free all engine state
+    void (*for_each_key)(KeyVisitor visit, void *ctx);  // enumerate live keys
+    size_t (*capacity)(void);                      // slots, 0 if not allocated
+    int (*resize)(size_t new_size, int nthreads);  // rebuild between steps, NULL if unsupported
+    int (*begin_step)(const char *action, int nthreads);  // per-step setup, may be NULL
+    void (*end_step)(void);                        // after each step (g_live_keys updated), may be NULL
+    int approximate;                               // 1 -> filter: false positives, keys not enumerable
+    int shared_table;                              // 1 -> MAP_SHARED table, not copy-on-write across fork()
+} HashEngine;
+
 // Global hash table and synchronization
 static HashEntry *g_table = NULL;
 static size_t g_table_size = 0;
 static pthread_mutex_t *bucketLocks = NULL;
+static size_t g_live_keys = 0;  // live keys in g_table as of the last completed step
 
 // Forward declarations
 static inline uint64_t fnv1a64(const char *data, size_t len);
+static int select_kernels(const char *isa);
 static void *worker(void *arg);
 static int ensure_table_and_locks(size_t size);
 static void cleanup_table_and_locks(void);
-static void write_operation_results(const ProgramArgs *args, int op_index, const char *action,
+static void lock_for_each_key(KeyVisitor visit, void *ctx);
+static size_t lock_capacity(void);
+static int lock_resize(size_t new_size, int nthreads);
+static int lock_begin_step(const char *action, int nthreads);
+static void lock_end_step(void);
+static int delegate_ensure(size_t size);
+static void *delegate_worker(void *arg);
+static void delegate_cleanup(void);
+static void delegate_for_each_key(KeyVisitor visit, void *ctx);
+static size_t delegate_capacity(void);
+static int delegate_begin_step(const char *action, int nthreads);
+static int split_ensure(size_t size);
+static void *split_worker(void *arg);
+static void split_cleanup(void);
+static void split_for_each_key(KeyVisitor visit, void *ctx);
+static size_t split_capacity(void);
+static int split_begin_step(const char *action, int nthreads);
+static int cuckoo_ensure(size_t size);
+static void *cuckoo_worker(void *arg);
+static void cuckoo_cleanup(void);
+static void cuckoo_for_each_key(KeyVisitor visit, void *ctx);
+static size_t cuckoo_capacity(void);
+static void cuckoo_end_step(void);
+static int disk_ensure(size_t size);
+static void *disk_worker(void *arg);
+static void disk_cleanup(void);
+static void disk_for_each_key(KeyVisitor visit, void *ctx);
+static size_t disk_capacity(void);
+static int disk_begin_step(const char *action, int nthreads);
+static void disk_end_step(void);
+static int write_operation_results(const ProgramArgs *args, int op_index, const char *action,
                                    size_t lineCount, StringMetadata *metadata, 
                                    size_t *indices, char *results, 
                                    long long elapsed_ms, size_t total_collisions);
 static int execute_hash_operation(const ProgramArgs *args, int op_index, const char *action,
                                  size_t lineCount, StringMetadata *metadata);
+static int progress_start(ProgressReporter *rep, const ProgramArgs *args, int op_index,
+                          const char *action, size_t total_keys,
+                          ThreadProgress *slots, int nthreads);
+static void progress_stop(ProgressReporter *rep);
+
+// Registered engines; the first one is the default
+static const HashEngine g_engines[] = {
+    { "lock", ensure_table_and_locks, worker, cleanup_table_and_locks, lock_for_each_key,
+      lock_capacity, lock_resize, lock_begin_step, lock_end_step, 0, 0 },
+    { "delegate", delegate_ensure, delegate_worker, delegate_cleanup, delegate_for_each_key,
+      delegate_capacity, NULL, delegate_begin_step, NULL, 0, 0 },
+    { "split", split_ensure, split_worker, split_cleanup, split_for_each_key,
+      split_capacity, NULL, split_begin_step, NULL, 0, 0 },
+    { "cuckoo", cuckoo_ensure, cuckoo_worker, cuckoo_cleanup, cuckoo_for_each_key,
+      cuckoo_capacity, NULL, NULL, cuckoo_end_step, 1, 0 },
+    { "disk", disk_ensure, disk_worker, disk_cleanup, disk_for_each_key,
+      disk_capacity, NULL, disk_begin_step, disk_end_step, 0, 1 },
+};
+#define NUM_ENGINES (sizeof(g_engines) / sizeof(g_engines[0]))
+
+static const HashEngine *g_engine = &g_engines[0];
+
+// Look up an engine by name, NULL if unknown
+static const HashEngine *find_engine(const char *name) {
+    for (size_t i = 0; i < NUM_ENGINES; ++i) {
+        if (strcmp(g_engines[i].name, name) == 0) return &g_engines[i];
+    }
+    return NULL;
+}
+
+// Engines whose workers answer read-only lookup steps
+static int engine_has_lookup(const char *engine) {
+    return strcmp(engine, "lock") == 0 || strcmp(engine, "disk") == 0 || strcmp(engine, "cuckoo") == 0;
+}
+
+// Actions that combine two tables instead of updating the engine
+static int is_set_action(const char *action) {
+    return strcmp(action, "union") == 0 || strcmp(action, "intersect") == 0 ||
+           strcmp(action, "difference") == 0;
+}
 
 // Function to parse size with K/M suffix
 size_t parse_size(const char *str) {
@@ -90,6 +376,28 @@ char* deparse_size(size_t size, char *buffer, size_t buffer_size) {
 // Function to parse command-line arguments
 int parse_arguments(int argc, char *argv[], ProgramArgs *args) {
     args->num_operations = 0;
+    args->engine = g_engines[0].name;
+    args->presize = NULL;
+    args->target_load = DEFAULT_TARGET_LOAD;
+    args->shrink_below = 0.0;
+    args->reader = "stdio";
+    args->cache_mb = -1;
+    args->compress_results = 0;
+    args->progress_ms = 0;
+    args->metrics_file = NULL;
+    args->results_dir = "results";
+    args->isa = "auto";
+    args->zero_copy = 0;
+    args->analyze = 0;
+    args->calibrate = 0;
+    args->fpr = CUCKOO_DEFAULT_FPR;
+    args->disk_file = NULL;
+    args->hot_cache = 0;
+    args->profile_file = NULL;
+    args->profile_hz = PROF_DEFAULT_HZ;
+    args->num_tables = 0;
+    args->topk = HH_DEFAULT_K;
+    args->sketch_counters = HH_DEFAULT_COUNTERS;
     int found_data_size = 0, found_threads = 0, found_tsize = 0;
     int found_flow = 0, found_input = 0;
 
@@ -106,6 +414,119 @@ int parse_arguments(int argc, char *argv[], ProgramArgs *args) {
             args->tsize = parse_size(argv[++i]);
             found_tsize = 1;
             i++;
+        } else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            args->engine = argv[++i];
+            if (!find_engine(args->engine)) {
+                fprintf(stderr, "Error: Unknown engine '%s'\n", args->engine);
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--presize") == 0 && i + 1 < argc) {
+            args->presize = argv[++i];
+            if (strcmp(args->presize, "data_size") != 0 && strcmp(args->presize, "hll") != 0) {
+                fprintf(stderr, "Error: --presize must be 'data_size' or 'hll'\n");
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--target_load") == 0 && i + 1 < argc) {
+            args->target_load = atof(argv[++i]);
+            if (args->target_load <= 0.0 || args->target_load >= 1.0) {
+                fprintf(stderr, "Error: --target_load must be in (0, 1)\n");
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--shrink_below") == 0 && i + 1 < argc) {
+            args->shrink_below = atof(argv[++i]);
+            if (args->shrink_below <= 0.0 || args->shrink_below * 2 >= RESIZE_GROW_LOAD) {
+                fprintf(stderr, "Error: --shrink_below must be in (0, %.3f)\n", RESIZE_GROW_LOAD / 2);
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--reader") == 0 && i + 1 < argc) {
+            args->reader = argv[++i];
+            if (strcmp(args->reader, "stdio") != 0 && strcmp(args->reader, "uring") != 0 &&
+                strcmp(args->reader, "pread") != 0) {
+                fprintf(stderr, "Error: --reader must be 'stdio', 'uring' or 'pread'\n");
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--compress_results") == 0) {
+            args->compress_results = 1;
+            i++;
+        } else if (strcmp(argv[i], "--cache_mb") == 0 && i + 1 < argc) {
+            args->cache_mb = atol(argv[++i]);
+            i++;
+        } else if (strcmp(argv[i], "--progress_ms") == 0 && i + 1 < argc) {
+            args->progress_ms = atol(argv[++i]);
+            i++;
+        } else if (strcmp(argv[i], "--metrics_file") == 0 && i + 1 < argc) {
+            args->metrics_file = argv[++i];
+            i++;
+        } else if (strcmp(argv[i], "--hot_cache") == 0 && i + 1 < argc) {
+            args->hot_cache = parse_size(argv[++i]);
+            i++;
+        } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            args->profile_file = argv[++i];
+            i++;
+        } else if (strcmp(argv[i], "--profile_hz") == 0 && i + 1 < argc) {
+            args->profile_hz = atoi(argv[++i]);
+            if (args->profile_hz < 1 || args->profile_hz > 100000) {
+                fprintf(stderr, "Error: --profile_hz must be in [1, 100000]\n");
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--disk_file") == 0 && i + 1 < argc) {
+            args->disk_file = argv[++i];
+            i++;
+        } else if (strcmp(argv[i], "--fpr") == 0 && i + 1 < argc) {
+            args->fpr = atof(argv[++i]);
+            if (args->fpr <= 0.0 || args->fpr >= 1.0) {
+                fprintf(stderr, "Error: --fpr must be in (0, 1)\n");
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--calibrate") == 0) {
+            args->calibrate = 1;
+            i++;
+        } else if (strcmp(argv[i], "--analyze") == 0) {
+            args->analyze = 1;
+            i++;
+        } else if (strcmp(argv[i], "--zero_copy") == 0) {
+            args->zero_copy = 1;
+            i++;
+        } else if (strcmp(argv[i], "--isa") == 0 && i + 1 < argc) {
+            args->isa = argv[++i];
+            if (select_kernels(args->isa) != 0) return 1;
+            i++;
+        } else if (strcmp(argv[i], "--topk") == 0 && i + 1 < argc) {
+            args->topk = strtoull(argv[++i], NULL, 10);
+            if (args->topk == 0) {
+                fprintf(stderr, "Error: --topk must be positive\n");
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--sketch_counters") == 0 && i + 1 < argc) {
+            args->sketch_counters = parse_size(argv[++i]);
+            if (args->sketch_counters == 0 || args->sketch_counters > INT32_MAX / 2) {
+                fprintf(stderr, "Error: --sketch_counters must be in 1..%d\n", INT32_MAX / 2);
+                return 1;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--table") == 0 && i + 2 < argc) {
+            if (args->num_tables >= SET_MAX_TABLES) {
+                fprintf(stderr, "Error: Too many tables (max %d)\n", SET_MAX_TABLES);
+                return 1;
+            }
+            if (strchr(argv[i + 1], ',')) {
+                fprintf(stderr, "Error: Table name '%s' may not contain ','\n", argv[i + 1]);
+                return 1;
+            }
+            args->table_name[args->num_tables] = argv[i + 1];
+            args->table_file[args->num_tables++] = argv[i + 2];
+            i += 3;
+        } else if (strcmp(argv[i], "--results_dir") == 0 && i + 1 < argc) {
+            args->results_dir = argv[++i];
+            i++;
         } else if (strcmp(argv[i], "--flow") == 0) {
             found_flow = 1;
             i++;
@@ -131,10 +552,16 @@ int parse_arguments(int argc, char *argv[], ProgramArgs *args) {
                 }
                 args->input_files[count++] = argv[i++];
             }
-            if (count != args->num_operations) {
-                fprintf(stderr, "Error: Number of input files (%d) must match number of actions (%d)\n", count, args->num_operations);
+            // freeze takes no input file
+            int inputs = 0;
+            for (int j = 0; j < args->num_operations; ++j) inputs += strcmp(args->action[j], "freeze") != 0;
+            if (count != inputs) {
+                fprintf(stderr, "Error: Number of input files (%d) must match number of actions (%d)\n", count, inputs);
                 return 1;
             }
+            for (int j = args->num_operations - 1; j >= 0; --j) {
+                args->input_files[j] = strcmp(args->action[j], "freeze") == 0 ? NULL : args->input_files[--count];
+            }
         } else {
             fprintf(stderr, "Error: Unknown or misplaced argument '%s'\n", argv[i]);
             return 1;
@@ -147,11 +574,86 @@ int parse_arguments(int argc, char *argv[], ProgramArgs *args) {
         fprintf(stderr, "  --data_size <size>\n");
         fprintf(stderr, "  --threads <num>\n");
         fprintf(stderr, "  --tsize <size>\n");
-        fprintf(stderr, "  --flow <action1> <action2> ...\n");
-        fprintf(stderr, "  --input <file1> <file2> ...\n");
+        fprintf(stderr, "  --flow <action1> <action2> ...   (insert, delete, lookup, freeze,\n");
+        fprintf(stderr, "                                    union, intersect, difference, topk,\n");
+        fprintf(stderr, "                                    snapshot)\n");
+        fprintf(stderr, "  --input <file1> <file2> ...      (one per action except freeze;\n");
+        fprintf(stderr, "                                    <table>,<table> for set actions,\n");
+        fprintf(stderr, "                                    the output path for snapshot)\n");
+        fprintf(stderr, "Optional:\n");
+        fprintf(stderr, "  --engine <name>         hash engine (default: %s)\n", g_engines[0].name);
+        fprintf(stderr, "  --presize <mode>        size the table from 'data_size' or an 'hll' estimate\n");
+        fprintf(stderr, "  --target_load <lf>      load factor for --presize (default %.2f)\n", DEFAULT_TARGET_LOAD);
+        fprintf(stderr, "  --shrink_below <lf>     shrink the table between steps below this load\n");
+        fprintf(stderr, "  --reader <name>         input reader: stdio (default), uring or pread\n");
+        fprintf(stderr, "  --compress_results      write results as .txt.gz (parallel gzip members)\n");
+        fprintf(stderr, "  --cache_mb <mb>         cap for inputs cached across steps (0 disables)\n");
+        fprintf(stderr, "  --progress_ms <ms>      sample per-thread progress to stderr every <ms>\n");
+        fprintf(stderr, "  --metrics_file <path>   also write samples as a Prometheus textfile\n");
+        fprintf(stderr, "  --results_dir <dir>     where result files are written (default results)\n");
+        fprintf(stderr, "  --isa <level>           kernel level: auto (default), scalar, sse4.2\n");
+        fprintf(stderr, "  --zero_copy             keys reference the loaded inputs (lock engine)\n");
+        fprintf(stderr, "  --analyze               report clustering and hash uniformity per step (lock engine)\n");
+        fprintf(stderr, "  --calibrate             measure memory bandwidth/latency and rate each step against it\n");
+        fprintf(stderr, "  --fpr <rate>            false-positive rate of the cuckoo engine (default %.3f)\n", CUCKOO_DEFAULT_FPR);
+        fprintf(stderr, "  --hot_cache <entries>   per-thread cache of recent key results (lock engine)\n");
+        fprintf(stderr, "  --profile <file>        sample all threads, write folded stacks for flamegraphs\n");
+        fprintf(stderr, "  --profile_hz <hz>       samples per second of thread CPU time (default %d)\n", PROF_DEFAULT_HZ);
+        fprintf(stderr, "  --disk_file <path>      backing file of the disk engine (default <results_dir>/disk_table.bin)\n");
+        fprintf(stderr, "  --table <name> <file>   name a file for set actions (repeatable)\n");
+        fprintf(stderr, "  --topk <k>              keys reported by the topk action (default %d)\n", HH_DEFAULT_K);
+        fprintf(stderr, "  --sketch_counters <m>   Space-Saving counters per thread for topk (default %d)\n",
+                HH_DEFAULT_COUNTERS);
+        return 1;
+    }
+
+    if (args->analyze && strcmp(args->engine, "lock") != 0) {
+        fprintf(stderr, "Error: --analyze is only supported by the lock engine\n");
+        return 1;
+    }
+
+    if (args->hot_cache && strcmp(args->engine, "lock") != 0) {
+        fprintf(stderr, "Error: --hot_cache is only supported by the lock engine\n");
+        return 1;
+    }
+
+    if (args->zero_copy && strcmp(args->engine, "lock") != 0) {
+        fprintf(stderr, "Error: --zero_copy is only supported by the lock engine\n");
         return 1;
     }
 
+    // lookup is answered by a frozen index, or read-only by the lock, disk and cuckoo engines
+    int frozen = 0;
+    for (int j = 0; j < args->num_operations; ++j) {
+        if (strcmp(args->action[j], "freeze") == 0) {
+            if (find_engine(args->engine)->approximate) {
+                fprintf(stderr, "Error: freeze needs an engine that can enumerate its keys\n");
+                return 1;
+            }
+            frozen = 1;
+        } else if (strcmp(args->action[j], "lookup") == 0) {
+            if (!frozen && !engine_has_lookup(args->engine)) {
+                fprintf(stderr, "Error: lookup needs a preceding freeze with the %s engine\n", args->engine);
+                return 1;
+            }
+        } else if (strcmp(args->action[j], "snapshot") == 0) {
+            if (find_engine(args->engine)->approximate) {
+                fprintf(stderr, "Error: snapshot needs an engine that can enumerate its keys\n");
+                return 1;
+            }
+        } else if (is_set_action(args->action[j])) {
+            // Input is "<left>,<right>", each a --table name or a file
+            const char *comma = strchr(args->input_files[j], ',');
+            if (!comma || comma == args->input_files[j] || !comma[1] || strchr(comma + 1, ',')) {
+                fprintf(stderr, "Error: %s takes '<table>,<table>' as input, got '%s'\n",
+                        args->action[j], args->input_files[j]);
+                return 1;
+            }
+        } else if (strcmp(args->action[j], "insert") == 0 || strcmp(args->action[j], "delete") == 0) {
+            frozen = 0;
+        }
+    }
+
     return 0;
 }
 
@@ -165,6 +667,571 @@ static inline uint64_t fnv1a64(const char *data, size_t len) {
     return hash;
 }
 
+// ------------------------------------------------------------------------
+// Kernel dispatch. Each ISA level provides the full kernel set; variants are
+// compiled with target attributes so one binary runs everywhere, and
+// select_kernels() binds the best level the CPU supports (or the one forced
+// with --isa). All variants return identical results. A level is only kept
+// while "make bench" shows it beating the one below: for 12-byte lines
+// memchr beats the AVX2/AVX-512 scans, and glibc's memcmp matches vector
+// key compares, so key equality is plain memcmp. The hash stays the scalar
+// FNV-1a on every level: it decides slot numbers, so swapping it per host
+// would change the output.
+
+typedef struct {
+    const char *isa;                                       // level name
+    int (*supported)(void);
+    const char *(*scan_newline)(const char *p, size_t n);  // first '\n' or NULL
+    const char *scan_name;                                 // scan_newline as named in result headers
+} KernelSet;
+
+static int isa_always(void) {
+    return 1;
+}
+
+static const char *scan_newline_scalar(const char *p, size_t n) {
+    return (const char *)memchr(p, '\n', n);
+}
+
+#ifdef HW2_X86
+static int isa_sse42(void) {
+    return __builtin_cpu_supports("sse4.2");
+}
+
+__attribute__((target("sse4.2")))
+static const char *scan_newline_sse42(const char *p, size_t n) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p + i)), nl));
+        if (mask) return p + i + __builtin_ctz((unsigned)mask);
+    }
+    for (; i < n; i++) {
+        if (p[i] == '\n') return p + i;
+    }
+    return NULL;
+}
+#endif
+
+// Levels in ascending order; "auto" picks the last supported one
+static const KernelSet g_kernel_sets[] = {
+    { "scalar", isa_always, scan_newline_scalar, "memchr" },
+#ifdef HW2_X86
+    { "sse4.2", isa_sse42, scan_newline_sse42, "sse4.2" },
+#endif
+};
+#define NUM_KERNEL_SETS (sizeof(g_kernel_sets) / sizeof(g_kernel_sets[0]))
+
+static KernelSet g_kernels = { "scalar", isa_always, scan_newline_scalar, "memchr" };
+
+static int select_kernels(const char *isa) {
+#ifdef HW2_X86
+    __builtin_cpu_init();
+#endif
+    if (strcmp(isa, "auto") == 0) {
+        for (size_t i = NUM_KERNEL_SETS; i-- > 0;) {
+            if (g_kernel_sets[i].supported()) {
+                g_kernels = g_kernel_sets[i];
+                return 0;
+            }
+        }
+    }
+    for (size_t i = 0; i < NUM_KERNEL_SETS; i++) {
+        if (strcmp(g_kernel_sets[i].isa, isa) != 0) continue;
+        if (!g_kernel_sets[i].supported()) {
+            fprintf(stderr, "Error: --isa %s is not supported by this CPU\n", isa);
+            return -1;
+        }
+        g_kernels = g_kernel_sets[i];
+        return 0;
+    }
+    fprintf(stderr, "Error: Unknown --isa level '%s'\n", isa);
+    return -1;
+}
+
+// ------------------------------------------------------------------------
+// Sampling profiler (--profile): every thread started through spawn_thread
+// (and the main thread) arms a timer_create timer on its own CPU clock
+// that sends SIGPROF to that thread only. The handler stores the
+// interrupted IP plus a shallow frame-pointer walk, bounded by the thread's
+// stack, into a per-thread buffer; nothing is shared or allocated while
+// sampling. At exit the addresses are symbolised from the executable's own
+// .symtab (static functions included), then dladdr, else as module+0xoff
+// which addr2line -f -e <module> resolves, and written as folded stacks
+// ("root;...;leaf count") for flamegraph.pl. Build with "make profile" for
+// frame pointers; without them stacks stop after the first frame or two.
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+typedef struct ProfThread {
+    struct ProfThread *next;
+    timer_t timer;
+    uintptr_t stack_lo, stack_hi;  // frame pointers outside are not followed
+    size_t samples;
+    size_t dropped;
+    uint8_t depth[PROF_MAX_SAMPLES];
+    uintptr_t frames[PROF_MAX_SAMPLES][PROF_STACK_DEPTH];  // leaf first
+} ProfThread;
+
+typedef struct {
+    uintptr_t start;
+    size_t size;
+    const char *name;
+} ProfSymbol;
+
+typedef struct {
+    void *(*fn)(void *);
+    void *arg;
+} ProfStart;
+
+static int g_prof_hz = 0;                   // 0 -> profiler off
+static ProfThread *g_prof_threads = NULL;   // buffers of finished threads
+static pthread_mutex_t g_prof_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_int g_prof_unsampled = 0;     // threads whose timer could not be armed
+static __thread ProfThread *t_prof = NULL;
+
+// Reads raw stack words, so it is exempt from ASan's redzone checks
+__attribute__((no_sanitize_address))
+static void prof_signal(int sig, siginfo_t *info, void *context) {
+    (void)sig;
+    (void)info;
+    ProfThread *pt = t_prof;
+    if (!pt) return;
+    if (pt->samples == PROF_MAX_SAMPLES) {
+        pt->dropped++;
+        return;
+    }
+    const ucontext_t *uc = (const ucontext_t *)context;
+#if defined(__x86_64__)
+    uintptr_t ip = (uintptr_t)uc->uc_mcontext.gregs[REG_RIP];
+    uintptr_t fp = (uintptr_t)uc->uc_mcontext.gregs[REG_RBP];
+#elif defined(__aarch64__)
+    uintptr_t ip = (uintptr_t)uc->uc_mcontext.pc;
+    uintptr_t fp = (uintptr_t)uc->uc_mcontext.regs[29];
+#else
+    uintptr_t ip = 0, fp = 0;
+    (void)uc;
+#endif
+    uintptr_t *frames = pt->frames[pt->samples];
+    int n = 0;
+    frames[n++] = ip;
+    // Each frame holds {saved fp, return address}; stop at anything that
+    // does not look like a frame of this thread's stack
+    while (n < PROF_STACK_DEPTH && fp % sizeof(uintptr_t) == 0 &&
+           fp >= pt->stack_lo && fp + 2 * sizeof(uintptr_t) <= pt->stack_hi) {
+        const uintptr_t *frame = (const uintptr_t *)fp;
+        if (frame[1] == 0) break;
+        frames[n++] = frame[1] - 1;  // inside the call, so it symbolises to the caller
+        if (frame[0] <= fp) break;
+        fp = frame[0];
+    }
+    pt->depth[pt->samples++] = (uint8_t)n;
+}
+
+// Arm the calling thread's CPU-time timer
+static void prof_thread_begin(void) {
+    ProfThread *pt = (ProfThread *)malloc(sizeof(ProfThread));
+    if (!pt) {
+        atomic_fetch_add(&g_prof_unsampled, 1);
+        return;
+    }
+    pt->next = NULL;
+    pt->samples = pt->dropped = 0;
+    pt->stack_lo = pt->stack_hi = 0;
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+        void *lo;
+        size_t size;
+        if (pthread_attr_getstack(&attr, &lo, &size) == 0) {
+            pt->stack_lo = (uintptr_t)lo;
+            pt->stack_hi = (uintptr_t)lo + size;
+        }
+        pthread_attr_destroy(&attr);
+    }
+
+    struct sigevent sev;
+    memset(&sev, 0, sizeof(sev));
+    sev.sigev_notify = SIGEV_THREAD_ID;
+    sev.sigev_signo = SIGPROF;
+    sev.sigev_notify_thread_id = (pid_t)syscall(SYS_gettid);
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &pt->timer) != 0) {
+        free(pt);
+        atomic_fetch_add(&g_prof_unsampled, 1);
+        return;
+    }
+    t_prof = pt;
+
+    long period_ns = 1000000000L / g_prof_hz;
+    struct itimerspec its;
+    its.it_interval.tv_sec = its.it_value.tv_sec = period_ns / 1000000000L;
+    its.it_interval.tv_nsec = its.it_value.tv_nsec = period_ns % 1000000000L;
+    timer_settime(pt->timer, 0, &its, NULL);
+}
+
+// Disarm the calling thread's timer and hand its samples to the report
+static void prof_thread_end(void) {
+    ProfThread *pt = t_prof;
+    if (!pt) return;
+    timer_delete(pt->timer);
+    t_prof = NULL;  // a SIGPROF still pending is ignored
+    pthread_mutex_lock(&g_prof_lock);
+    pt->next = g_prof_threads;
+    g_prof_threads = pt;
+    pthread_mutex_unlock(&g_prof_lock);
+}
+
+static void *prof_trampoline(void *p) {
+    ProfStart start = *(ProfStart *)p;
+    free(p);
+    prof_thread_begin();
+    void *ret = start.fn(start.arg);
+    prof_thread_end();
+    return ret;
+}
+
+// pthread_create for worker threads; samples them while the profiler is on
+static int spawn_thread(pthread_t *thread, void *(*fn)(void *), void *arg) {
+    if (!g_prof_hz) return pthread_create(thread, NULL, fn, arg);
+    ProfStart *start = (ProfStart *)malloc(sizeof(ProfStart));
+    if (!start) return ENOMEM;
+    start->fn = fn;
+    start->arg = arg;
+    int rc = pthread_create(thread, NULL, prof_trampoline, start);
+    if (rc != 0) free(start);
+    return rc;
+}
+
+static int prof_start(int hz) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = prof_signal;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGPROF, &sa, NULL) != 0) {
+        perror("sigaction SIGPROF");
+        return -1;
+    }
+    g_prof_hz = hz;
+    atomic_store(&g_prof_unsampled, 0);
+    prof_thread_begin();
+    return 0;
+}
+
+static int prof_symbol_cmp(const void *a, const void *b) {
+    const ProfSymbol *x = (const ProfSymbol *)a, *y = (const ProfSymbol *)b;
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+static int prof_line_cmp(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Function symbols of the running executable from its .symtab; names point
+// into *image, which the caller frees. Returns the count, 0 if unavailable.
+static size_t prof_load_symbols(ProfSymbol **out, char **image, uintptr_t *bias) {
+    *out = NULL;
+    *image = NULL;
+    Dl_info self;
+    if (!dladdr((void *)prof_load_symbols, &self)) return 0;
+
+    FILE *f = fopen("/proc/self/exe", "rb");
+    if (!f) return 0;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *data = size > 0 ? (char *)malloc((size_t)size) : NULL;
+    if (!data || fread(data, 1, (size_t)size, f) != (size_t)size) {
+        free(data);
+        fclose(f);
+        return 0;
+    }
+    fclose(f);
+
+    const Elf64_Ehdr *eh = (const Elf64_Ehdr *)data;
+    if ((size_t)size < sizeof(*eh) || memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 ||
+        eh->e_ident[EI_CLASS] != ELFCLASS64 ||
+        eh->e_shoff + (size_t)eh->e_shnum * sizeof(Elf64_Shdr) > (size_t)size) {
+        free(data);
+        return 0;
+    }
+    *bias = eh->e_type == ET_DYN ? (uintptr_t)self.dli_fbase : 0;
+
+    const Elf64_Shdr *sh = (const Elf64_Shdr *)(data + eh->e_shoff);
+    ProfSymbol *list = NULL;
+    size_t count = 0;
+    for (int s = 0; s < eh->e_shnum; s++) {
+        if (sh[s].sh_type != SHT_SYMTAB || sh[s].sh_link >= eh->e_shnum) continue;
+        const Elf64_Shdr *strs = &sh[sh[s].sh_link];
+        if (sh[s].sh_offset + sh[s].sh_size > (size_t)size ||
+            strs->sh_offset + strs->sh_size > (size_t)size) continue;
+        const Elf64_Sym *syms = (const Elf64_Sym *)(data + sh[s].sh_offset);
+        size_t nsyms = sh[s].sh_size / sizeof(Elf64_Sym);
+        list = (ProfSymbol *)malloc(nsyms * sizeof(ProfSymbol));
+        if (!list) break;
+        for (size_t i = 0; i < nsyms; i++) {
+            if (ELF64_ST_TYPE(syms[i].st_info) != STT_FUNC || syms[i].st_shndx == SHN_UNDEF ||
+                syms[i].st_value == 0 || syms[i].st_name >= strs->sh_size) continue;
+            list[count].start = (uintptr_t)syms[i].st_value + *bias;
+            list[count].size = syms[i].st_size;
+            list[count].name = data + strs->sh_offset + syms[i].st_name;
+            count++;
+        }
+        break;
+    }
+    if (count == 0) {
+        free(list);
+        free(data);
+        return 0;
+    }
+    qsort(list, count, sizeof(ProfSymbol), prof_symbol_cmp);
+    *out = list;
+    *image = data;
+    return count;
+}
+
+// Folded-stack name of one frame: function name, else module+0xoffset with
+// the offset addr2line expects (link-time address for a non-PIE executable).
+// Returns -1 for an address outside every loaded module.
+static int prof_frame_name(const ProfSymbol *syms, size_t nsyms, uintptr_t bias, uintptr_t exe_base,
+                            uintptr_t addr, char *buf, size_t size) {
+    size_t lo = 0, hi = nsyms;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (syms[mid].start <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo > 0 && addr < syms[lo - 1].start + (syms[lo - 1].size ? syms[lo - 1].size : 1)) {
+        snprintf(buf, size, "%s", syms[lo - 1].name);
+        return 0;
+    }
+    Dl_info info;
+    if (dladdr((void *)addr, &info) && info.dli_fname) {
+        if (info.dli_sname) {
+            snprintf(buf, size, "%s", info.dli_sname);
+            return 0;
+        }
+        const char *module = strrchr(info.dli_fname, '/');
+        module = module ? module + 1 : info.dli_fname;
+        uintptr_t base = (uintptr_t)info.dli_fbase == exe_base ? bias : (uintptr_t)info.dli_fbase;
+        snprintf(buf, size, "%s+0x%lx", module, (unsigned long)(addr - base));
+        return 0;
+    }
+    snprintf(buf, size, "0x%lx", (unsigned long)addr);
+    return -1;
+}
+
+// Stop sampling and write every collected stack to path as folded lines
+static int prof_finish(const char *path) {
+    prof_thread_end();
+    g_prof_hz = 0;
+    pthread_mutex_lock(&g_prof_lock);
+    ProfThread *threads = g_prof_threads;
+    g_prof_threads = NULL;
+    pthread_mutex_unlock(&g_prof_lock);
+
+    size_t total = 0, dropped = 0;
+    int nthreads = 0;
+    for (ProfThread *pt = threads; pt; pt = pt->next) {
+        total += pt->samples;
+        dropped += pt->dropped;
+        nthreads++;
+    }
+
+    ProfSymbol *syms;
+    char *image;
+    uintptr_t bias = 0;
+    size_t nsyms = prof_load_symbols(&syms, &image, &bias);
+    Dl_info self;
+    uintptr_t exe_base = dladdr((void *)prof_finish, &self) ? (uintptr_t)self.dli_fbase : 0;
+    if (!nsyms) bias = exe_base;
+
+    int rc = 0;
+    char **lines = (char **)calloc(total ? total : 1, sizeof(char *));
+    size_t nlines = 0;
+    char name[256];
+    for (ProfThread *pt = threads; pt && lines; pt = pt->next) {
+        for (size_t s = 0; s < pt->samples; s++) {
+            // Code built without frame pointers (libc) leaves junk in the
+            // frame register; keep the stack up to the first non-code address
+            int depth = 1;
+            while (depth < pt->depth[s] &&
+                   prof_frame_name(syms, nsyms, bias, exe_base, pt->frames[s][depth], name, sizeof(name)) == 0) {
+                depth++;
+            }
+            char line[PROF_STACK_DEPTH * 96];
+            size_t used = 0;
+            for (int d = depth - 1; d >= 0; d--) {
+                prof_frame_name(syms, nsyms, bias, exe_base, pt->frames[s][d], name, sizeof(name));
+                int w = snprintf(line + used, sizeof(line) - used, "%s%s", used ? ";" : "", name);
+                if (w < 0 || (size_t)w >= sizeof(line) - used) break;
+                used += (size_t)w;
+            }
+            line[used] = '\0';
+            lines[nlines] = strdup(line);
+            if (!lines[nlines]) break;
+            nlines++;
+        }
+    }
+    if (!lines || nlines < total) {
+        perror("Memory allocation failed for profile");
+        rc = -1;
+    }
+
+    FILE *out = rc == 0 ? fopen(path, "w") : NULL;
+    if (rc == 0 && !out) {
+        perror("Error opening profile output");
+        rc = -1;
+    }
+    if (out) {
+        qsort(lines, nlines, sizeof(char *), prof_line_cmp);
+        for (size_t i = 0; i < nlines;) {
+            size_t j = i + 1;
+            while (j < nlines && strcmp(lines[i], lines[j]) == 0) j++;
+            fprintf(out, "%s %zu\n", lines[i], j - i);
+            i = j;
+        }
+        if (fclose(out) != 0) {
+            perror("Error writing profile output");
+            rc = -1;
+        }
+    }
+    if (rc == 0) {
+        printf("Profile: %zu samples from %d threads (%zu dropped, %d not sampled) -> %s\n",
+               total, nthreads, dropped, atomic_load(&g_prof_unsampled), path);
+        if (!nsyms) printf("Profile: no .symtab in the executable, frames are module+offset\n");
+    }
+
+    for (size_t i = 0; lines && i < nlines; i++) free(lines[i]);
+    free(lines);
+    free(syms);
+    free(image);
+    while (threads) {
+        ProfThread *next = threads->next;
+        free(threads);
+        threads = next;
+    }
+    return rc;
+}
+
+// ------------------------------------------------------------------------
+// Hot-key cache (--hot_cache): a small direct-mapped cache per worker
+// thread of recent (hash, key) -> (slot, present) results, so repeats of
+// hot keys in skewed inputs skip g_table and its bucket locks. Within one
+// step the table only changes one way, so two global epochs keep entries
+// exact: delete steps and rebuilds invalidate cached "present" results,
+// insert steps invalidate cached "absent" ones. A present entry answers
+// insert and lookup, an absent entry answers delete and lookup; deleting
+// a present key still goes to the table. Keys up to HOT_KEY_MAX bytes are
+// copied inline so a hit touches only the thread's own cache.
+
+typedef struct {
+    uint64_t hash;
+    size_t slot;
+    uint32_t epoch;           // epoch of the present/absent kind it was cached under
+    uint8_t present;
+    uint8_t length;           // 0 -> unused entry
+    char key[HOT_KEY_MAX];
+} HotEntry;
+
+typedef struct {
+    _Alignas(64) HotEntry *entries;  // one cache line per thread for the counters
+    size_t hits;
+    size_t lookups;
+} HotCache;
+
+static size_t g_hot_entries = 0;          // per thread, power of two, 0 -> disabled
+static HotCache *g_hot_caches = NULL;
+static int g_hot_threads = 0;
+static uint32_t g_hot_present_epoch = 1;
+static uint32_t g_hot_absent_epoch = 1;
+
+static inline HotEntry *hot_entry(HotCache *hc, uint64_t hash) {
+    return &hc->entries[(hash ^ (hash >> 32)) & (g_hot_entries - 1)];
+}
+
+// Answer item from the cache if it holds a valid result for this action.
+// A found lookup reports its probe distance as collisions, like the table walk.
+static int hot_answer(HotCache *hc, WorkerArgs *wa, size_t item, uint64_t hash,
+                      const char *key, size_t length, int is_insert, int is_delete,
+                      size_t *collisions) {
+    hc->lookups++;
+    HotEntry *he = hot_entry(hc, hash);
+    if (he->length != length || he->hash != hash || memcmp(he->key, key, length) != 0) return 0;
+    if (he->present) {
+        if (is_delete || he->epoch != g_hot_present_epoch) return 0;
+        wa->out_indices[item] = he->slot;
+        wa->out_results[item] = 'T';
+        if (!is_insert) *collisions += (he->slot + g_table_size - hash % g_table_size) % g_table_size;
+    } else {
+        if (is_insert || he->epoch != g_hot_absent_epoch) return 0;
+        wa->out_results[item] = 'F';
+    }
+    hc->hits++;
+    return 1;
+}
+
+// Remember the outcome of an operation that went to the table
+static void hot_fill(HotCache *hc, const WorkerArgs *wa, size_t item, uint64_t hash,
+                     const char *key, size_t length, int is_insert, int is_delete) {
+    if (length == 0 || length > HOT_KEY_MAX) return;
+    HotEntry *he = hot_entry(hc, hash);
+    int present = is_insert || (!is_delete && wa->out_results[item] == 'T');
+    he->hash = hash;
+    he->slot = present ? wa->out_indices[item] : 0;
+    he->present = (uint8_t)present;
+    he->epoch = present ? g_hot_present_epoch : g_hot_absent_epoch;
+    he->length = (uint8_t)length;
+    memcpy(he->key, key, length);
+}
+
+static void hot_cache_release(void) {
+    for (int t = 0; t < g_hot_threads; t++) free(g_hot_caches[t].entries);
+    free(g_hot_caches);
+    g_hot_caches = NULL;
+    g_hot_threads = 0;
+}
+
+static int lock_begin_step(const char *action, int nthreads) {
+    if (!g_hot_entries) return 0;
+    if (nthreads > g_hot_threads) {
+        HotCache *caches = (HotCache *)aligned_alloc(64, nthreads * sizeof(HotCache));
+        if (!caches) {
+            perror("Memory allocation failed for hot-key cache");
+            return 1;
+        }
+        if (g_hot_threads) memcpy(caches, g_hot_caches, g_hot_threads * sizeof(HotCache));
+        free(g_hot_caches);
+        g_hot_caches = caches;
+        for (int t = g_hot_threads; t < nthreads; t++) {
+            memset(&g_hot_caches[t], 0, sizeof(HotCache));
+            g_hot_caches[t].entries = (HotEntry *)calloc(g_hot_entries, sizeof(HotEntry));
+            if (!g_hot_caches[t].entries) {
+                perror("Memory allocation failed for hot-key cache");
+                g_hot_threads = t;
+                return 1;
+            }
+        }
+        g_hot_threads = nthreads;
+    }
+    if (strcmp(action, "insert") == 0) g_hot_absent_epoch++;
+    else if (strcmp(action, "delete") == 0) g_hot_present_epoch++;
+    for (int t = 0; t < g_hot_threads; t++) g_hot_caches[t].hits = g_hot_caches[t].lookups = 0;
+    return 0;
+}
+
+static void lock_end_step(void) {
+    if (!g_hot_entries) return;
+    size_t hits = 0, lookups = 0;
+    for (int t = 0; t < g_hot_threads; t++) {
+        hits += g_hot_caches[t].hits;
+        lookups += g_hot_caches[t].lookups;
+    }
+    printf("Hot-key cache: %.1f%% hits (%zu of %zu), %zu entries per thread\n",
+           lookups ? 100.0 * (double)hits / (double)lookups : 0.0, hits, lookups, g_hot_entries);
+}
+
 // Ensure global hash table and locks are allocated
 static int ensure_table_and_locks(size_t size) {
     if (g_table) return 0;
@@ -203,7 +1270,7 @@ static void cleanup_table_and_locks(void) {
 
     if (g_table) {
         for (size_t i = 0; i < g_table_size; i++) {
-            if (g_table[i].key) {
+            if (g_table[i].key && !g_table[i].source) {
                 free(g_table[i].key->ptr);
                 free(g_table[i].key);
             }
@@ -211,387 +1278,4994 @@ static void cleanup_table_and_locks(void) {
         free(g_table);
         g_table = NULL;
     }
+    g_live_keys = 0;
+    hot_cache_release();
 }
 
-// Worker thread function
-static void *worker(void *arg) {
-    WorkerArgs *workerArg = (WorkerArgs *)arg;
-    size_t thread_collisions = 0;
+// Enumerate live keys of the locking table (not thread-safe; call between steps)
+static void lock_for_each_key(KeyVisitor visit, void *ctx) {
+    for (size_t i = 0; i < g_table_size; i++) {
+        if (g_table[i].key) visit(g_table[i].key->ptr, g_table[i].key->length, i, ctx);
+    }
+}
 
-    for (size_t itemIndex = workerArg->start; itemIndex < workerArg->end; ++itemIndex) {
-        const char *currentString = workerArg->meta[itemIndex].ptr;
-        size_t stringLength = workerArg->meta[itemIndex].length;
+static size_t lock_capacity(void) {
+    return g_table ? g_table_size : 0;
+}
 
-        uint64_t hash = fnv1a64(currentString, stringLength);
-        size_t tablePos = hash % g_table_size;
-        size_t first_tombstone = (size_t)(-1);
-        size_t local_collisions = 0;
+// Arguments for one rebuild thread
+typedef struct {
+    size_t start;             // inclusive, old table slot
+    size_t end;               // exclusive
+    HashEntry *new_table;
+    pthread_mutex_t *new_locks;
+    size_t new_size;
+} RebuildArgs;
 
-        if (strcmp(workerArg->action, "insert") == 0) {
-            // Insert operation
-            while (1) {
-                pthread_mutex_lock(&bucketLocks[tablePos]);
-                HashEntry *e = &g_table[tablePos];
+// Move the live keys of one old-table range into the new table. Key
+// storage is moved, not copied; tombstones are dropped.
+static void *rebuild_worker(void *arg) {
+    RebuildArgs *rb = (RebuildArgs *)arg;
 
-                if (e->key == NULL) {
-                    if (e->tombstone) {
-                        // Found tombstone, remember first one
-                        if (first_tombstone == (size_t)(-1)) {
-                            first_tombstone = tablePos;
-                        }
-                        pthread_mutex_unlock(&bucketLocks[tablePos]);
-                    } else {
-                        // Empty slot - use either first tombstone or this slot
-                        size_t target = (first_tombstone == (size_t)(-1)) ? tablePos : first_tombstone;
-                        if (target != tablePos) {
-                            pthread_mutex_unlock(&bucketLocks[tablePos]);
-                            pthread_mutex_lock(&bucketLocks[target]);
-                        }
+    for (size_t i = rb->start; i < rb->end; i++) {
+        StringMetadata *key = g_table[i].key;
+        if (!key) continue;
 
-                        g_table[target].key = malloc(sizeof(StringMetadata));
-                        if (g_table[target].key) {
-                            g_table[target].key->ptr = malloc(stringLength + 1);
-                            if (g_table[target].key->ptr) {
-                                memcpy(g_table[target].key->ptr, currentString, stringLength);
-                                g_table[target].key->ptr[stringLength] = '\0';
-                                g_table[target].key->length = stringLength;
-                            } else {
-                                free(g_table[target].key);
-                                g_table[target].key = NULL;
-                            }
-                        }
-                        g_table[target].tombstone = 0;
-                        workerArg->out_indices[itemIndex] = target;
-                        workerArg->out_results[itemIndex] = 'F'; // did not exist
-                        thread_collisions += local_collisions;
-                        pthread_mutex_unlock(&bucketLocks[target]);
-                        break;
+        size_t pos = fnv1a64(key->ptr, key->length) % rb->new_size;
+        while (1) {
+            pthread_mutex_lock(&rb->new_locks[pos]);
+            if (rb->new_table[pos].key == NULL) {
+                rb->new_table[pos].key = key;
+                rb->new_table[pos].source = g_table[i].source;
+                pthread_mutex_unlock(&rb->new_locks[pos]);
+                break;
+            }
+            pthread_mutex_unlock(&rb->new_locks[pos]);
+            pos = (pos + 1) % rb->new_size;
+        }
+    }
+    return NULL;
+}
+
+// Rebuild g_table with new_size slots using nthreads threads
+static int lock_resize(size_t new_size, int nthreads) {
+    if (!g_table || new_size == g_table_size || new_size <= g_live_keys) return 0;
+
+    HashEntry *new_table = (HashEntry *)calloc(new_size, sizeof(HashEntry));
+    pthread_mutex_t *new_locks = (pthread_mutex_t *)malloc(new_size * sizeof(pthread_mutex_t));
+    if (!new_table || !new_locks) {
+        perror("Unable to allocate resized hash table");
+        free(new_table);
+        free(new_locks);
+        return -1;
+    }
+    for (size_t i = 0; i < new_size; i++) {
+        pthread_mutex_init(&new_locks[i], NULL);
+    }
+
+    if (nthreads < 1) nthreads = 1;
+    if ((size_t)nthreads > g_table_size) nthreads = (int)g_table_size;
+
+    pthread_t *threads = (pthread_t *)malloc(nthreads * sizeof(pthread_t));
+    RebuildArgs *rargs = (RebuildArgs *)malloc(nthreads * sizeof(RebuildArgs));
+    if (!threads || !rargs) {
+        perror("Thread allocation failed");
+        free(threads);
+        free(rargs);
+        for (size_t i = 0; i < new_size; i++) pthread_mutex_destroy(&new_locks[i]);
+        free(new_locks);
+        free(new_table);
+        return -1;
+    }
+
+    size_t chunk = (g_table_size + nthreads - 1) / nthreads;
+    for (int t = 0; t < nthreads; ++t) {
+        size_t start = t * chunk;
+        size_t end = start + chunk;
+        if (start > g_table_size) start = g_table_size;
+        if (end > g_table_size) end = g_table_size;
+
+        rargs[t] = (RebuildArgs){
+            .start = start,
+            .end = end,
+            .new_table = new_table,
+            .new_locks = new_locks,
+            .new_size = new_size
+        };
+        spawn_thread(&threads[t], rebuild_worker, &rargs[t]);
+    }
+    for (int t = 0; t < nthreads; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+    free(rargs);
+
+    // Keys now belong to new_table; release the old slots and locks only
+    for (size_t i = 0; i < g_table_size; i++) {
+        pthread_mutex_destroy(&bucketLocks[i]);
+    }
+    free(bucketLocks);
+    free(g_table);
+
+    g_table = new_table;
+    bucketLocks = new_locks;
+    g_table_size = new_size;
+    g_hot_present_epoch++;  // cached slots moved
+    return 0;
+}
+
+// ------------------------------------------------------------------------
+// Delegation engine. The table is split into contiguous partitions, each
+// probed (with wrap-around) only inside itself. Partition p is owned by
+// thread p % owners for the step. A thread executes keys of its own
+// partitions directly and publishes the line index of every other key into
+// the single-producer single-consumer ring it shares with that key's owner.
+// Owners drain their rings and execute operations without any locks,
+// writing indices/results straight into the WorkerArgs output arrays.
+
+typedef struct {
+    _Atomic size_t head;      // next entry to consume (owner)
+    char pad1[64 - sizeof(size_t)];
+    _Atomic size_t tail;      // next entry to fill (producer)
+    char pad2[64 - sizeof(size_t)];
+    uint32_t items[DELEGATE_RING_SIZE];
+} DelegateRing;
+
+static HashEntry *d_table = NULL;
+static size_t d_table_size = 0;
+static size_t d_partitions = 0;
+static size_t d_partition_slots = 0;   // slots per partition (last one takes the rest)
+
+// Per-step state set up by delegate_begin_step()
+static DelegateRing *d_rings = NULL;   // owners x nthreads, ring (o, p) at o * nthreads + p
+static int d_ring_threads = 0;
+static int d_owners = 0;
+static _Atomic int d_producers_remaining;
+
+static int delegate_ensure(size_t size) {
+    if (d_table) return 0;
+
+    d_partitions = size / DELEGATE_MIN_PARTITION_SLOTS;
+    if (d_partitions > DELEGATE_MAX_PARTITIONS) d_partitions = DELEGATE_MAX_PARTITIONS;
+    if (d_partitions < 1) d_partitions = 1;
+    d_partition_slots = size / d_partitions;
+
+    d_table_size = size;
+    d_table = (HashEntry *)calloc(d_table_size, sizeof(HashEntry));
+    if (!d_table) {
+        perror("Unable to allocate hash table");
+        return -1;
+    }
+    return 0;
+}
+
+static void delegate_cleanup(void) {
+    if (d_table) {
+        for (size_t i = 0; i < d_table_size; i++) {
+            if (d_table[i].key) {
+                free(d_table[i].key->ptr);
+                free(d_table[i].key);
+            }
+        }
+        free(d_table);
+        d_table = NULL;
+    }
+    free(d_rings);
+    d_rings = NULL;
+    d_ring_threads = 0;
+    g_live_keys = 0;
+}
+
+static void delegate_for_each_key(KeyVisitor visit, void *ctx) {
+    for (size_t i = 0; i < d_table_size; i++) {
+        if (d_table[i].key) visit(d_table[i].key->ptr, d_table[i].key->length, i, ctx);
+    }
+}
+
+static size_t delegate_capacity(void) {
+    return d_table ? d_table_size : 0;
+}
+
+// Rings are kept across steps and only rebuilt when the thread count changes
+static int delegate_begin_step(const char *action, int nthreads) {
+    (void)action;
+    d_owners = (size_t)nthreads < d_partitions ? nthreads : (int)d_partitions;
+
+    if (d_ring_threads != nthreads) {
+        free(d_rings);
+        d_rings = (DelegateRing *)aligned_alloc(64, (size_t)d_owners * nthreads * sizeof(DelegateRing));
+        if (!d_rings) {
+            perror("Unable to allocate delegation rings");
+            d_ring_threads = 0;
+            return -1;
+        }
+        d_ring_threads = nthreads;
+    }
+    for (size_t r = 0; r < (size_t)d_owners * nthreads; r++) {
+        atomic_init(&d_rings[r].head, 0);
+        atomic_init(&d_rings[r].tail, 0);
+    }
+    atomic_store(&d_producers_remaining, nthreads);
+    return 0;
+}
+
+static inline size_t delegate_partition(uint64_t hash) {
+    return (size_t)(hash >> 32) % d_partitions;
+}
+
+// Per-owner running totals
+typedef struct {
+    size_t executed;
+    size_t collisions;
+    long long live_delta;
+} DelegateCounters;
+
+// Execute one operation inside its partition; only the owner gets here
+static void delegate_execute(WorkerArgs *wa, int is_insert, size_t item, DelegateCounters *c) {
+    const char *key = wa->meta[item].ptr;
+    size_t len = wa->meta[item].length;
+    uint64_t hash = fnv1a64(key, len);
+    size_t p = delegate_partition(hash);
+    size_t base = p * d_partition_slots;
+    size_t slots = (p + 1 == d_partitions) ? d_table_size - base : d_partition_slots;
+    size_t pos = hash % slots;
+    size_t first_tombstone = (size_t)(-1);
+    size_t local_collisions = 0;
+
+    while (1) {
+        HashEntry *e = &d_table[base + pos];
+
+        if (e->key == NULL) {
+            if (e->tombstone) {
+                if (is_insert) {
+                    if (first_tombstone == (size_t)(-1)) first_tombstone = pos;
+                } else {
+                    local_collisions++;
+                }
+            } else if (is_insert) {
+                size_t target = base + ((first_tombstone == (size_t)(-1)) ? pos : first_tombstone);
+                d_table[target].key = malloc(sizeof(StringMetadata));
+                if (d_table[target].key) {
+                    d_table[target].key->ptr = malloc(len + 1);
+                    if (d_table[target].key->ptr) {
+                        memcpy(d_table[target].key->ptr, key, len);
+                        d_table[target].key->ptr[len] = '\0';
+                        d_table[target].key->length = len;
+                    } else {
+                        free(d_table[target].key);
+                        d_table[target].key = NULL;
                     }
-                } else if (e->key->length == stringLength && 
-                          memcmp(e->key->ptr, currentString, stringLength) == 0) {
-                    // Key already exists
-                    workerArg->out_indices[itemIndex] = tablePos;
-                    workerArg->out_results[itemIndex] = 'T'; // existed
-                    pthread_mutex_unlock(&bucketLocks[tablePos]);
-                    break;
+                }
+                d_table[target].tombstone = 0;
+                wa->out_indices[item] = target;
+                wa->out_results[item] = 'F';
+                c->collisions += local_collisions;
+                c->live_delta++;
+                break;
+            } else {
+                wa->out_results[item] = 'F';
+                break;
+            }
+        } else if (e->key->length == len && memcmp(e->key->ptr, key, len) == 0) {
+            wa->out_indices[item] = base + pos;
+            wa->out_results[item] = 'T';
+            if (!is_insert) {
+                free(e->key->ptr);
+                free(e->key);
+                e->key = NULL;
+                e->tombstone = 1;
+                c->collisions += local_collisions;
+                c->live_delta--;
+            }
+            break;
+        } else if (!is_insert || first_tombstone == (size_t)(-1)) {
+            local_collisions++;
+        }
+        pos = (pos + 1) % slots;
+    }
+    c->executed++;
+}
+
+// Publish the owner's counters for the progress reporter
+static void delegate_publish(WorkerArgs *wa, const DelegateCounters *c) {
+    atomic_store_explicit(&wa->progress->keys_done, c->executed, memory_order_relaxed);
+    atomic_store_explicit(&wa->progress->collisions, c->collisions, memory_order_relaxed);
+    atomic_store_explicit(&wa->progress->live_delta, c->live_delta, memory_order_relaxed);
+}
+
+// Execute everything currently queued for this owner; returns ops executed
+static size_t delegate_drain(WorkerArgs *wa, int is_insert, DelegateCounters *c) {
+    size_t executed = 0;
+    for (int p = 0; p < wa->nthreads; p++) {
+        DelegateRing *ring = &d_rings[(size_t)wa->thread_id * wa->nthreads + p];
+        size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head == tail) continue;
+
+        executed += tail - head;
+        for (; head != tail; head++) {
+            delegate_execute(wa, is_insert, ring->items[head & (DELEGATE_RING_SIZE - 1)], c);
+        }
+        atomic_store_explicit(&ring->head, head, memory_order_release);
+    }
+    return executed;
+}
+
+static void *delegate_worker(void *arg) {
+    WorkerArgs *wa = (WorkerArgs *)arg;
+    int is_insert = strcmp(wa->action, "insert") == 0;
+    int is_owner = wa->thread_id < d_owners;
+    DelegateCounters c = { 0, 0, 0 };
+
+    for (size_t item = wa->start; item < wa->end; item++) {
+        uint64_t hash = fnv1a64(wa->meta[item].ptr, wa->meta[item].length);
+        int owner = (int)(delegate_partition(hash) % (size_t)d_owners);
+
+        if (owner == wa->thread_id) {
+            delegate_execute(wa, is_insert, item, &c);
+        } else {
+            DelegateRing *ring = &d_rings[(size_t)owner * wa->nthreads + wa->thread_id];
+            size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+            // Ring full: help by serving our own queue (owners) or yield
+            while (tail - atomic_load_explicit(&ring->head, memory_order_acquire) == DELEGATE_RING_SIZE) {
+                if (!is_owner || delegate_drain(wa, is_insert, &c) == 0) sched_yield();
+            }
+            ring->items[tail & (DELEGATE_RING_SIZE - 1)] = (uint32_t)item;
+            atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+        }
+
+        if (is_owner && (item - wa->start) % DELEGATE_DRAIN_INTERVAL == 0) {
+            delegate_drain(wa, is_insert, &c);
+            delegate_publish(wa, &c);
+        }
+    }
+    atomic_fetch_sub_explicit(&d_producers_remaining, 1, memory_order_acq_rel);
+
+    // Serve remaining requests until every producer is done and rings are empty
+    while (is_owner) {
+        int remaining = atomic_load_explicit(&d_producers_remaining, memory_order_acquire);
+        size_t executed = delegate_drain(wa, is_insert, &c);
+        delegate_publish(wa, &c);
+        if (executed == 0) {
+            if (remaining == 0) break;
+            sched_yield();
+        }
+    }
+
+    delegate_publish(wa, &c);
+    *(wa->collision_count) = c.collisions;
+    return NULL;
+}
+
+// ------------------------------------------------------------------------
+// Split-ordered chaining engine (Shalev & Shavit). All keys live in one
+// lock-free sorted linked list (Harris/Michael marking) ordered by the
+// bit-reversed hash; bucket b points at a dummy node inside the list, so
+// doubling the bucket count only adds dummies and never moves nodes.
+// Buckets are initialised lazily from their parent bucket. Nodes and key
+// bytes come from per-thread arenas and are never reused before cleanup,
+// which rules out ABA on the list pointers. The index reported for a key
+// is its node id, which stays stable across resizes.
+
+typedef struct SplitNode {
+    _Atomic uintptr_t next;   // successor, low bit set -> this node is deleted
+    uint64_t so_key;          // reversed hash; LSB 1 for keys, 0 for bucket dummies
+    const char *key;          // NULL for dummies
+    size_t length;
+    size_t id;                // stable slot id reported in results
+} SplitNode;
+
+typedef struct SplitBlock {
+    struct SplitBlock *next;
+} SplitBlock;
+
+// Per-thread allocation state, indexed by WorkerArgs.thread_id
+typedef struct {
+    SplitNode *nodes;
+    size_t nodes_used, nodes_cap;
+    size_t first_id;          // id of nodes[0]
+    char *bytes;
+    size_t bytes_used, bytes_cap;
+    SplitBlock *blocks;       // every chunk, for cleanup
+    SplitNode *spare;         // node left over from a lost insert race
+    long long count_pending;  // key-count delta not yet added to split_count
+    char pad[64];
+} SplitArena;
+
+static _Atomic(_Atomic(SplitNode *) *) split_segments[SPLIT_SEGMENTS];
+static _Atomic size_t split_buckets = 0;
+static _Atomic long long split_count = 0;
+static _Atomic size_t split_next_id = 0;
+static SplitNode *split_head = NULL;      // dummy of bucket 0
+static SplitArena *split_arenas = NULL;
+static int split_arena_count = 0;
+
+static inline uint64_t reverse64(uint64_t x) {
+    x = ((x >> 1) & 0x5555555555555555ULL) | ((x & 0x5555555555555555ULL) << 1);
+    x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+    x = ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((x & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    return __builtin_bswap64(x);
+}
+
+static inline SplitNode *split_ptr(uintptr_t link) {
+    return (SplitNode *)(link & ~(uintptr_t)1);
+}
+
+static void *split_block_alloc(SplitArena *arena, size_t size) {
+    SplitBlock *block = (SplitBlock *)malloc(sizeof(SplitBlock) + size);
+    if (!block) return NULL;
+    block->next = arena->blocks;
+    arena->blocks = block;
+    return block + 1;
+}
+
+static SplitNode *split_new_node(SplitArena *arena) {
+    if (arena->spare) {
+        SplitNode *node = arena->spare;
+        arena->spare = NULL;
+        return node;
+    }
+    if (arena->nodes_used == arena->nodes_cap) {
+        arena->nodes = (SplitNode *)split_block_alloc(arena, SPLIT_CHUNK_NODES * sizeof(SplitNode));
+        if (!arena->nodes) {
+            arena->nodes_cap = arena->nodes_used = 0;
+            return NULL;
+        }
+        arena->nodes_cap = SPLIT_CHUNK_NODES;
+        arena->nodes_used = 0;
+        arena->first_id = atomic_fetch_add(&split_next_id, SPLIT_CHUNK_NODES);
+    }
+    SplitNode *node = &arena->nodes[arena->nodes_used];
+    node->id = arena->first_id + arena->nodes_used;
+    arena->nodes_used++;
+    return node;
+}
+
+static char *split_copy_key(SplitArena *arena, const char *key, size_t len) {
+    if (arena->bytes_used + len + 1 > arena->bytes_cap) {
+        size_t cap = len + 1 > SPLIT_CHUNK_BYTES ? len + 1 : SPLIT_CHUNK_BYTES;
+        arena->bytes = (char *)split_block_alloc(arena, cap);
+        if (!arena->bytes) {
+            arena->bytes_cap = arena->bytes_used = 0;
+            return NULL;
+        }
+        arena->bytes_cap = cap;
+        arena->bytes_used = 0;
+    }
+    char *copy = arena->bytes + arena->bytes_used;
+    memcpy(copy, key, len);
+    copy[len] = '\0';
+    arena->bytes_used += len + 1;
+    return copy;
+}
+
+// Bucket directory: bucket b lives in segment highest_bit(b) (0 and 1 in segment 0)
+static _Atomic(SplitNode *) *split_bucket_slot(size_t b, int create) {
+    size_t seg = b < 2 ? 0 : (size_t)(63 - __builtin_clzll((unsigned long long)b));
+    size_t offset = b < 2 ? b : b - ((size_t)1 << seg);
+    _Atomic(SplitNode *) *segment = atomic_load_explicit(&split_segments[seg], memory_order_acquire);
+
+    if (!segment && create) {
+        size_t len = seg == 0 ? 2 : (size_t)1 << seg;
+        _Atomic(SplitNode *) *fresh = (_Atomic(SplitNode *) *)calloc(len, sizeof(*fresh));
+        if (!fresh) return NULL;
+        _Atomic(SplitNode *) *expected = NULL;
+        if (atomic_compare_exchange_strong(&split_segments[seg], &expected, fresh)) {
+            segment = fresh;
+        } else {
+            free(fresh);
+            segment = expected;
+        }
+    }
+    return segment ? &segment[offset] : NULL;
+}
+
+// Order nodes by (so_key, length, bytes)
+static inline int split_compare(const SplitNode *node, uint64_t so_key, const char *key, size_t len) {
+    if (node->so_key != so_key) return node->so_key < so_key ? -1 : 1;
+    if (!node->key || !key) return 0;
+    if (node->length != len) return node->length < len ? -1 : 1;
+    return memcmp(node->key, key, len);
+}
+
+// Michael's list search from start: on return *pred_link is the link that
+// points to *curr, the first node not ordered before the target. Marked
+// nodes met on the way are unlinked. Returns 1 if *curr matches.
+static int split_find(SplitNode *start, uint64_t so_key, const char *key, size_t len,
+                      _Atomic uintptr_t **pred_link, SplitNode **curr, size_t *collisions) {
+retry:
+    *collisions = 0;
+    _Atomic uintptr_t *link = &start->next;
+    SplitNode *node = split_ptr(atomic_load_explicit(link, memory_order_acquire));
+
+    while (node) {
+        uintptr_t succ = atomic_load_explicit(&node->next, memory_order_acquire);
+        if (succ & 1) {
+            uintptr_t expected = (uintptr_t)node;
+            if (!atomic_compare_exchange_strong(link, &expected, succ & ~(uintptr_t)1)) goto retry;
+            node = split_ptr(succ);
+            continue;
+        }
+
+        int cmp = split_compare(node, so_key, key, len);
+        if (cmp >= 0) {
+            *pred_link = link;
+            *curr = node;
+            return cmp == 0;
+        }
+        if (node->key) (*collisions)++;
+        link = &node->next;
+        node = split_ptr(succ);
+    }
+
+    *pred_link = link;
+    *curr = NULL;
+    return 0;
+}
+
+// Link node into the list after start unless an equal node exists; returns
+// the node that ends up in the list
+static SplitNode *split_list_insert(SplitNode *start, SplitNode *node, size_t *collisions, int *inserted) {
+    while (1) {
+        _Atomic uintptr_t *link;
+        SplitNode *curr;
+        if (split_find(start, node->so_key, node->key, node->length, &link, &curr, collisions)) {
+            *inserted = 0;
+            return curr;
+        }
+        atomic_store_explicit(&node->next, (uintptr_t)curr, memory_order_relaxed);
+        uintptr_t expected = (uintptr_t)curr;
+        if (atomic_compare_exchange_strong(link, &expected, (uintptr_t)node)) {
+            *inserted = 1;
+            return node;
+        }
+    }
+}
+
+// Dummy node of bucket b, creating it (and its parents) on first use
+static SplitNode *split_bucket(SplitArena *arena, size_t b) {
+    _Atomic(SplitNode *) *slot = split_bucket_slot(b, 1);
+    if (!slot) return NULL;
+    SplitNode *dummy = atomic_load_explicit(slot, memory_order_acquire);
+    if (dummy) return dummy;
+
+    size_t parent_index = b & ~((size_t)1 << (63 - __builtin_clzll((unsigned long long)b)));
+    SplitNode *parent = split_bucket(arena, parent_index);
+    SplitNode *node = split_new_node(arena);
+    if (!parent || !node) return NULL;
+
+    node->so_key = reverse64(b);
+    node->key = NULL;
+    node->length = 0;
+    size_t ignored;
+    int inserted;
+    dummy = split_list_insert(parent, node, &ignored, &inserted);
+    if (!inserted) arena->spare = node;
+
+    atomic_store_explicit(slot, dummy, memory_order_release);
+    return dummy;
+}
+
+static int split_ensure(size_t size) {
+    (void)size;
+    if (split_head) return 0;
+
+    split_head = (SplitNode *)calloc(1, sizeof(SplitNode));
+    _Atomic(SplitNode *) *slot = split_bucket_slot(0, 1);
+    if (!split_head || !slot) {
+        perror("Unable to allocate split-ordered table");
+        free(split_head);
+        split_head = NULL;
+        return -1;
+    }
+    atomic_store(slot, split_head);
+    atomic_store(&split_buckets, SPLIT_INITIAL_BUCKETS);
+    atomic_store(&split_count, 0);
+    atomic_store(&split_next_id, 0);
+    return 0;
+}
+
+static void split_cleanup(void) {
+    for (int a = 0; a < split_arena_count; a++) {
+        SplitBlock *block = split_arenas[a].blocks;
+        while (block) {
+            SplitBlock *next = block->next;
+            free(block);
+            block = next;
+        }
+    }
+    free(split_arenas);
+    split_arenas = NULL;
+    split_arena_count = 0;
+
+    for (int s = 0; s < SPLIT_SEGMENTS; s++) {
+        free(atomic_load(&split_segments[s]));
+        atomic_store(&split_segments[s], NULL);
+    }
+    free(split_head);
+    split_head = NULL;
+    atomic_store(&split_buckets, 0);
+    g_live_keys = 0;
+}
+
+static void split_for_each_key(KeyVisitor visit, void *ctx) {
+    if (!split_head) return;
+    for (SplitNode *node = split_ptr(atomic_load(&split_head->next)); node;
+         node = split_ptr(atomic_load(&node->next))) {
+        if (node->key && !(atomic_load(&node->next) & 1)) visit(node->key, node->length, node->id, ctx);
+    }
+}
+
+// Bucket count; the load factor of this engine is keys per bucket
+static size_t split_capacity(void) {
+    return split_head ? atomic_load(&split_buckets) : 0;
+}
+
+// Arenas persist across steps so chunks keep filling up
+static int split_begin_step(const char *action, int nthreads) {
+    (void)action;
+    if (nthreads <= split_arena_count) return 0;
+
+    SplitArena *grown = (SplitArena *)realloc(split_arenas, nthreads * sizeof(SplitArena));
+    if (!grown) {
+        perror("Unable to allocate split-ordered arenas");
+        return -1;
+    }
+    memset(grown + split_arena_count, 0, (nthreads - split_arena_count) * sizeof(SplitArena));
+    split_arenas = grown;
+    split_arena_count = nthreads;
+    return 0;
+}
+
+// Fold a thread's pending count into the global one and double the bucket
+// count when the average chain grows past SPLIT_MAX_LOAD
+static void split_flush_count(SplitArena *arena) {
+    long long count = atomic_fetch_add(&split_count, arena->count_pending) + arena->count_pending;
+    arena->count_pending = 0;
+
+    size_t buckets = atomic_load(&split_buckets);
+    if (count > (long long)(buckets * SPLIT_MAX_LOAD) && buckets < ((size_t)1 << (SPLIT_SEGMENTS - 1))) {
+        atomic_compare_exchange_strong(&split_buckets, &buckets, buckets * 2);
+    }
+}
+
+static void *split_worker(void *arg) {
+    WorkerArgs *wa = (WorkerArgs *)arg;
+    SplitArena *arena = &split_arenas[wa->thread_id];
+    int is_insert = strcmp(wa->action, "insert") == 0;
+    size_t thread_collisions = 0;
+    long long live_delta = 0;
+
+    for (size_t item = wa->start; item < wa->end; item++) {
+        const char *key = wa->meta[item].ptr;
+        size_t len = wa->meta[item].length;
+        uint64_t hash = fnv1a64(key, len);
+        uint64_t so_key = reverse64(hash | 0x8000000000000000ULL);
+        SplitNode *bucket = split_bucket(arena, (size_t)(hash & (atomic_load(&split_buckets) - 1)));
+        size_t collisions = 0;
+
+        if (!bucket) {
+            wa->out_results[item] = 'F';
+            continue;
+        }
+
+        if (is_insert) {
+            _Atomic uintptr_t *link;
+            SplitNode *curr;
+            if (split_find(bucket, so_key, key, len, &link, &curr, &collisions)) {
+                wa->out_indices[item] = curr->id;
+                wa->out_results[item] = 'T';
+            } else {
+                SplitNode *node = split_new_node(arena);
+                char *copy = node ? split_copy_key(arena, key, len) : NULL;
+                if (!copy) {
+                    if (node) arena->spare = node;
+                    wa->out_results[item] = 'F';
+                    continue;
+                }
+                node->so_key = so_key;
+                node->key = copy;
+                node->length = len;
+
+                int inserted;
+                SplitNode *found = split_list_insert(bucket, node, &collisions, &inserted);
+                wa->out_indices[item] = found->id;
+                if (inserted) {
+                    wa->out_results[item] = 'F';
+                    thread_collisions += collisions;
+                    live_delta++;
+                    if (++arena->count_pending >= SPLIT_COUNT_FLUSH) split_flush_count(arena);
                 } else {
-                    // Different key, continue probing
-                    pthread_mutex_unlock(&bucketLocks[tablePos]);
-                    // Don't count collisions after first tombstone found
-                    if (first_tombstone == (size_t)(-1)) local_collisions++;
+                    wa->out_results[item] = 'T';
+                    arena->spare = node;
                 }
-                tablePos = (tablePos + 1) % g_table_size;
             }
-        } else if (strcmp(workerArg->action, "delete") == 0) {
-            // Delete operation
+        } else {
             while (1) {
-                pthread_mutex_lock(&bucketLocks[tablePos]);
-                HashEntry *e = &g_table[tablePos];
-
-                if (e->key == NULL) {
-                    if (e->tombstone) {
-                        // Keep probing past tombstones
-                        pthread_mutex_unlock(&bucketLocks[tablePos]);
-                        local_collisions++;
-                    } else {
-                        // Empty bucket - key not found
-                        workerArg->out_results[itemIndex] = 'F'; // not found
-                        pthread_mutex_unlock(&bucketLocks[tablePos]);
-                        break;
-                    }
-                } else if (e->key->length == stringLength && 
-                          memcmp(e->key->ptr, currentString, stringLength) == 0) {
-                    // Found key - delete it
-                    free(e->key->ptr);
-                    free(e->key);
-                    e->key = NULL;
-                    e->tombstone = 1;
-                    workerArg->out_indices[itemIndex] = tablePos;
-                    workerArg->out_results[itemIndex] = 'T'; // found and deleted
-                    thread_collisions += local_collisions;
-                    pthread_mutex_unlock(&bucketLocks[tablePos]);
+                _Atomic uintptr_t *link;
+                SplitNode *curr;
+                if (!split_find(bucket, so_key, key, len, &link, &curr, &collisions)) {
+                    wa->out_results[item] = 'F';
                     break;
-                } else {
-                    // Different key, continue probing
-                    pthread_mutex_unlock(&bucketLocks[tablePos]);
-                    local_collisions++;
                 }
+                uintptr_t succ = atomic_load_explicit(&curr->next, memory_order_acquire);
+                if (succ & 1) continue;  // lost to a concurrent delete; search again
+                if (!atomic_compare_exchange_strong(&curr->next, &succ, succ | 1)) continue;
+
+                wa->out_indices[item] = curr->id;
+                wa->out_results[item] = 'T';
+                thread_collisions += collisions;
+                live_delta--;
+                if (--arena->count_pending <= -SPLIT_COUNT_FLUSH) split_flush_count(arena);
+
+                // Logically deleted; unlink now or let a later search do it
+                uintptr_t expected = (uintptr_t)curr;
+                if (!atomic_compare_exchange_strong(link, &expected, succ)) {
+                    size_t ignored;
+                    split_find(bucket, so_key, key, len, &link, &curr, &ignored);
+                }
+                break;
+            }
+        }
+
+        // Publish progress periodically; relaxed stores to a thread-private line
+        size_t done = item - wa->start + 1;
+        if (done % PROGRESS_PUBLISH_INTERVAL == 0 || item + 1 == wa->end) {
+            atomic_store_explicit(&wa->progress->keys_done, done, memory_order_relaxed);
+            atomic_store_explicit(&wa->progress->collisions, thread_collisions, memory_order_relaxed);
+            atomic_store_explicit(&wa->progress->live_delta, live_delta, memory_order_relaxed);
+        }
+    }
+
+    if (arena->count_pending) split_flush_count(arena);
+    *(wa->collision_count) = thread_collisions;
+    return NULL;
+}
+
+// ------------------------------------------------------------------------
+// Cuckoo filter engine (Fan et al.): an approximate set holding only an
+// f-bit fingerprint per key, f chosen from --fpr. Each key has two candidate
+// buckets of CUCKOO_SLOTS fingerprints, i1 from the hash and
+// i2 = (h(fp) - i1) mod m, so either can be computed from the other. "T"
+// means the fingerprint was present, which may be a false positive; lookup
+// only reports it, delete removes one matching fingerprint. As in any cuckoo filter, a key answered
+// by a false positive is not stored, and deleting a key that is not stored
+// can remove a look-alike's fingerprint, so such keys may later read "F".
+//
+// Buckets are packed at CUCKOO_SLOTS * f bits, rounded up to whole bytes, so
+// neighbouring buckets never share a byte and one lock per bucket stripe is
+// enough. Operations lock the stripes of both candidates. An insert that
+// finds both full takes the single eviction mutex and searches an eviction
+// path, copying each bucket it visits under that bucket's stripe lock. The
+// path may be stale by the time it is used, so it is applied from the free
+// end backwards, each move re-checked under the locks of its two buckets: a
+// fingerprint is never out of both its buckets, so concurrent lookups
+// cannot miss it.
+
+static unsigned char *c_buckets = NULL;
+static size_t c_num_buckets = 0;
+static size_t c_bucket_bytes = 0;
+static unsigned c_fp_bits = 0;
+static atomic_flag c_locks[CUCKOO_LOCK_STRIPES];
+static pthread_mutex_t c_evict_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic size_t c_failed = 0;       // inserts dropped because the filter was full
+static double g_filter_fpr = CUCKOO_DEFAULT_FPR;
+
+static inline uint64_t cuckoo_load_bucket(size_t b) {
+    uint64_t word = 0;
+    memcpy(&word, c_buckets + b * c_bucket_bytes, c_bucket_bytes);
+    return word;
+}
+
+static inline void cuckoo_store_bucket(size_t b, uint64_t word) {
+    memcpy(c_buckets + b * c_bucket_bytes, &word, c_bucket_bytes);
+}
+
+static inline unsigned cuckoo_get(uint64_t word, int slot) {
+    return (unsigned)(word >> (slot * c_fp_bits)) & ((1u << c_fp_bits) - 1);
+}
+
+static inline uint64_t cuckoo_set(uint64_t word, int slot, unsigned fp) {
+    uint64_t mask = (uint64_t)((1u << c_fp_bits) - 1) << (slot * c_fp_bits);
+    return (word & ~mask) | ((uint64_t)fp << (slot * c_fp_bits));
+}
+
+static inline size_t cuckoo_alt(size_t b, unsigned fp) {
+    size_t h = (size_t)(((uint64_t)fp * 0x9E3779B97F4A7C15ULL) >> 32) % c_num_buckets;
+    return (h + c_num_buckets - b) % c_num_buckets;
+}
+
+static inline void cuckoo_lock(size_t a, size_t b) {
+    size_t sa = a & (CUCKOO_LOCK_STRIPES - 1), sb = b & (CUCKOO_LOCK_STRIPES - 1);
+    if (sa > sb) { size_t t = sa; sa = sb; sb = t; }
+    while (atomic_flag_test_and_set_explicit(&c_locks[sa], memory_order_acquire)) sched_yield();
+    if (sb != sa) {
+        while (atomic_flag_test_and_set_explicit(&c_locks[sb], memory_order_acquire)) sched_yield();
+    }
+}
+
+static inline void cuckoo_unlock(size_t a, size_t b) {
+    size_t sa = a & (CUCKOO_LOCK_STRIPES - 1), sb = b & (CUCKOO_LOCK_STRIPES - 1);
+    atomic_flag_clear_explicit(&c_locks[sa], memory_order_release);
+    if (sb != sa) atomic_flag_clear_explicit(&c_locks[sb], memory_order_release);
+}
+
+// Slot of fp in a bucket's word, or -1 (fp 0 marks an empty slot)
+static inline int cuckoo_word_find(uint64_t word, unsigned fp) {
+    for (int s = 0; s < CUCKOO_SLOTS; s++) {
+        if (cuckoo_get(word, s) == fp) return s;
+    }
+    return -1;
+}
+
+// Slot of fp in bucket b, or -1; caller holds b's stripe lock
+static inline int cuckoo_find(size_t b, unsigned fp) {
+    return cuckoo_word_find(cuckoo_load_bucket(b), fp);
+}
+
+static int cuckoo_ensure(size_t size) {
+    if (c_buckets) return 0;
+
+    // f = ceil(log2(2 * slots / fpr)): two buckets of CUCKOO_SLOTS are checked
+    double bits = ceil(log2(2.0 * CUCKOO_SLOTS / g_filter_fpr));
+    c_fp_bits = bits < 4 ? 4 : bits > 16 ? 16 : (unsigned)bits;
+    c_bucket_bytes = (CUCKOO_SLOTS * c_fp_bits + 7) / 8;
+    c_num_buckets = (size_t)ceil((double)size / (CUCKOO_SLOTS * CUCKOO_LOAD));
+    if (c_num_buckets < 2) c_num_buckets = 2;
+
+    c_buckets = (unsigned char *)calloc(c_num_buckets, c_bucket_bytes);
+    if (!c_buckets) {
+        perror("Unable to allocate cuckoo filter");
+        return -1;
+    }
+    for (int i = 0; i < CUCKOO_LOCK_STRIPES; i++) atomic_flag_clear(&c_locks[i]);
+    atomic_store(&c_failed, 0);
+
+    printf("Cuckoo filter: %zu buckets x %d, %u-bit fingerprints (fpr <= %.4f), %.1f KB\n",
+           c_num_buckets, CUCKOO_SLOTS, c_fp_bits, g_filter_fpr,
+           (double)(c_num_buckets * c_bucket_bytes) / 1024.0);
+    return 0;
+}
+
+static void cuckoo_cleanup(void) {
+    free(c_buckets);
+    c_buckets = NULL;
+    c_num_buckets = 0;
+    g_live_keys = 0;
+}
+
+// Fingerprints cannot be turned back into keys; nothing to enumerate
+static void cuckoo_for_each_key(KeyVisitor visit, void *ctx) {
+    (void)visit;
+    (void)ctx;
+}
+
+static size_t cuckoo_capacity(void) {
+    return c_buckets ? c_num_buckets * CUCKOO_SLOTS : 0;
+}
+
+static void cuckoo_end_step(void) {
+    size_t failed = atomic_exchange(&c_failed, 0);
+    if (failed) printf("Cuckoo filter full: %zu inserts dropped\n", failed);
+    if (c_num_buckets) {
+        printf("Cuckoo filter: load %.3f, %.1f bits per key\n",
+               (double)g_live_keys / (double)(c_num_buckets * CUCKOO_SLOTS),
+               g_live_keys ? 8.0 * (double)(c_num_buckets * c_bucket_bytes) / (double)g_live_keys : 0.0);
+    }
+}
+
+// Free a slot in bucket b0 by moving fingerprints along an eviction path.
+// Caller holds c_evict_lock and no stripe locks. Returns moves made, -1 if
+// no path was found.
+static int cuckoo_make_room(size_t b0, uint64_t *rng) {
+    size_t path_bucket[CUCKOO_MAX_KICKS + 1];
+    int path_slot[CUCKOO_MAX_KICKS];
+    unsigned path_fp[CUCKOO_MAX_KICKS];
+
+    for (int attempt = 0; attempt < CUCKOO_PATH_RETRIES; attempt++) {
+        // Random walk until a bucket with a free slot; each bucket is read
+        // under its own stripe lock, which is dropped before the next one
+        int len = 0;
+        size_t b = b0;
+        path_bucket[0] = b0;
+        int found = 0;
+        while (len < CUCKOO_MAX_KICKS) {
+            cuckoo_lock(b, b);
+            uint64_t word = cuckoo_load_bucket(b);
+            cuckoo_unlock(b, b);
+            if (cuckoo_word_find(word, 0) >= 0) {
+                found = 1;
+                break;
+            }
+            *rng ^= *rng << 13; *rng ^= *rng >> 7; *rng ^= *rng << 17;
+            int s = (int)(*rng % CUCKOO_SLOTS);
+            unsigned fp = cuckoo_get(word, s);
+            path_slot[len] = s;
+            path_fp[len] = fp;
+            b = cuckoo_alt(b, fp);
+            path_bucket[++len] = b;
+        }
+        if (!found) continue;
+        if (len == 0) return 0;
+
+        // Apply from the free end; stop and search again if the table changed
+        int k;
+        for (k = len - 1; k >= 0; k--) {
+            size_t from = path_bucket[k], to = path_bucket[k + 1];
+            cuckoo_lock(from, to);
+            uint64_t src = cuckoo_load_bucket(from);
+            int free_slot = cuckoo_find(to, 0);
+            if (cuckoo_get(src, path_slot[k]) != path_fp[k] || free_slot < 0) {
+                cuckoo_unlock(from, to);
+                break;
+            }
+            if (to == from) {
+                // A fingerprint whose buckets coincide: just move within it
+                src = cuckoo_set(cuckoo_set(src, free_slot, path_fp[k]), path_slot[k], 0);
+                cuckoo_store_bucket(from, src);
+            } else {
+                cuckoo_store_bucket(to, cuckoo_set(cuckoo_load_bucket(to), free_slot, path_fp[k]));
+                cuckoo_store_bucket(from, cuckoo_set(src, path_slot[k], 0));
+            }
+            cuckoo_unlock(from, to);
+        }
+        if (k < 0) return len;
+    }
+    return -1;
+}
+
+static void *cuckoo_worker(void *arg) {
+    WorkerArgs *wa = (WorkerArgs *)arg;
+    int is_insert = strcmp(wa->action, "insert") == 0;
+    int is_delete = strcmp(wa->action, "delete") == 0;
+    size_t thread_collisions = 0;
+    long long live_delta = 0;
+    uint64_t rng = 0x9E3779B97F4A7C15ULL ^ ((uint64_t)wa->thread_id << 32 | 1);
+
+    for (size_t item = wa->start; item < wa->end; item++) {
+        uint64_t hash = fnv1a64(wa->meta[item].ptr, wa->meta[item].length);
+        unsigned fp = (unsigned)((hash >> 32) % ((1u << c_fp_bits) - 1)) + 1;
+        size_t i1 = (size_t)(((hash & 0xFFFFFFFFULL) * c_num_buckets) >> 32);
+        size_t i2 = cuckoo_alt(i1, fp);
+
+        wa->out_results[item] = 'F';
+        int done = 0;
+        for (int pass = 0; !done; pass++) {
+            cuckoo_lock(i1, i2);
+            int s1 = cuckoo_find(i1, fp), s2 = s1 < 0 ? cuckoo_find(i2, fp) : -1;
+            if (s1 >= 0 || s2 >= 0) {
+                // Present (or a false positive); lookup leaves it in place
+                size_t b = s1 >= 0 ? i1 : i2;
+                int s = s1 >= 0 ? s1 : s2;
+                wa->out_indices[item] = b * CUCKOO_SLOTS + s;
+                wa->out_results[item] = 'T';
+                if (is_delete) {
+                    cuckoo_store_bucket(b, cuckoo_set(cuckoo_load_bucket(b), s, 0));
+                    live_delta--;
+                }
+                done = 1;
+            } else if (!is_insert) {
+                done = 1;
+            } else {
+                int e1 = cuckoo_find(i1, 0), e2 = e1 < 0 ? cuckoo_find(i2, 0) : -1;
+                if (e1 >= 0 || e2 >= 0) {
+                    size_t b = e1 >= 0 ? i1 : i2;
+                    int s = e1 >= 0 ? e1 : e2;
+                    cuckoo_store_bucket(b, cuckoo_set(cuckoo_load_bucket(b), s, fp));
+                    wa->out_indices[item] = b * CUCKOO_SLOTS + s;
+                    live_delta++;
+                    done = 1;
+                }
+            }
+            cuckoo_unlock(i1, i2);
+
+            if (!done) {
+                // Both candidates full: evict along a path, then retry
+                pthread_mutex_lock(&c_evict_lock);
+                int moves = pass < CUCKOO_PATH_RETRIES ? cuckoo_make_room((pass & 1) ? i2 : i1, &rng) : -1;
+                pthread_mutex_unlock(&c_evict_lock);
+                if (moves < 0) {
+                    atomic_fetch_add(&c_failed, 1);
+                    done = 1;
+                } else {
+                    thread_collisions += (size_t)moves;
+                }
+            }
+        }
+
+        // Publish progress periodically; relaxed stores to a thread-private line
+        size_t processed = item - wa->start + 1;
+        if (processed % PROGRESS_PUBLISH_INTERVAL == 0 || item + 1 == wa->end) {
+            atomic_store_explicit(&wa->progress->keys_done, processed, memory_order_relaxed);
+            atomic_store_explicit(&wa->progress->collisions, thread_collisions, memory_order_relaxed);
+            atomic_store_explicit(&wa->progress->live_delta, live_delta, memory_order_relaxed);
+        }
+    }
+
+    *(wa->collision_count) = thread_collisions;
+    return NULL;
+}
+
+// ------------------------------------------------------------------------
+// Disk engine: an out-of-core table whose buckets are DISK_PAGE-byte pages
+// of a file mapped MAP_SHARED, so the kernel can write back and evict them
+// like any file cache instead of holding the table in anonymous memory.
+// A key hashes to a home page that holds it unless the page was full, so a
+// lookup touches one page; full pages set an overflow flag and the key
+// goes to the next page with room (the file has spare pages at the end,
+// chains never wrap). Pages are slotted: a directory of (offset, length)
+// entries from the front, NUL-terminated keys packed from the back. Slot
+// numbers never move (deletes free the entry, compaction only moves bytes),
+// so the index page * DISK_MAX_SLOTS + slot is stable.
+//
+// Each worker sorts its operations by home page before running them
+// (stable, so repeats of a key keep their order) and sweeps the file in
+// page order, turning random I/O into sequential runs. All operations on a
+// key hold its home page lock; overflow pages are locked one at a time
+// above it, always in increasing page order.
+
+typedef struct {
+    uint16_t off;             // key offset in the page, 0 -> free entry
+    uint16_t len;             // key length without the NUL
+} DiskSlot;
+
+typedef struct {
+    uint16_t nslots;          // directory entries, in use or free
+    uint16_t key_start;       // keys occupy [key_start, DISK_PAGE), 0 -> empty page
+    uint16_t dead;            // bytes of deleted keys inside the key area
+    uint8_t overflow;         // an insert passed this page because it was full
+    uint8_t pad;
+    DiskSlot slot[];
+} DiskPage;
+
+typedef struct {
+    size_t page;
+    size_t item;
+} DiskOp;
+
+static char *g_disk_map = NULL;
+static size_t g_disk_home_pages = 0;    // pages keys hash to
+static size_t g_disk_pages = 0;         // including spare overflow pages
+static pthread_mutex_t *g_disk_locks = NULL;
+static int g_disk_fd = -1;
+static const char *g_disk_path = NULL;  // NULL -> anonymous temporary file
+static int g_disk_unlink = 0;           // remove g_disk_path at cleanup
+static _Atomic size_t d_page_visits = 0;
+static _Atomic size_t d_keys = 0;
+static _Atomic size_t d_failed = 0;     // inserts that found no page with room
+static _Atomic int d_workers_done = 0;  // the last worker of a step flushes the map
+static double d_sync_ms = 0.0;
+static long d_minflt = 0, d_majflt = 0;
+static long long d_read = 0, d_written = 0;
+
+static inline DiskPage *disk_page(size_t p) {
+    return (DiskPage *)(g_disk_map + p * DISK_PAGE);
+}
+
+static inline size_t disk_key_start(const DiskPage *pg) {
+    return pg->key_start ? pg->key_start : DISK_PAGE;
+}
+
+// Process-wide fault counts and storage I/O (bytes), -1 when unavailable
+static void disk_io_counters(long *minflt, long *majflt, long long *rd, long long *wr) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    *minflt = ru.ru_minflt;
+    *majflt = ru.ru_majflt;
+    *rd = *wr = -1;
+    FILE *f = fopen("/proc/self/io", "r");
+    if (!f) return;
+    char line[128];
+    while (fgets(line, sizeof(line), f)) {
+        sscanf(line, "read_bytes: %lld", rd);
+        sscanf(line, "write_bytes: %lld", wr);
+    }
+    fclose(f);
+}
+
+static int disk_ensure(size_t size) {
+    if (g_disk_map) return 0;
+
+    g_disk_home_pages = size / DISK_KEYS_PER_PAGE + 1;
+    g_disk_pages = g_disk_home_pages + DISK_SPARE_PAGES;
+    if (g_disk_path) {
+        g_disk_fd = open(g_disk_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    } else {
+        char tmp[] = "/tmp/hw2_disk_XXXXXX";
+        g_disk_fd = mkstemp(tmp);
+        if (g_disk_fd >= 0) unlink(tmp);
+    }
+    if (g_disk_fd < 0) {
+        perror("Cannot create disk table file");
+        return 1;
+    }
+
+    // The file starts sparse: all-zero pages are empty
+    size_t bytes = g_disk_pages * DISK_PAGE;
+    if (ftruncate(g_disk_fd, (off_t)bytes) != 0) {
+        perror("Cannot size disk table file");
+        disk_cleanup();
+        return 1;
+    }
+    g_disk_map = (char *)mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, g_disk_fd, 0);
+    if (g_disk_map == MAP_FAILED) {
+        g_disk_map = NULL;
+        perror("Cannot map disk table file");
+        disk_cleanup();
+        return 1;
+    }
+    g_disk_locks = (pthread_mutex_t *)malloc(g_disk_pages * sizeof(pthread_mutex_t));
+    if (!g_disk_locks) {
+        perror("Memory allocation failed for page locks");
+        disk_cleanup();
+        return 1;
+    }
+    for (size_t p = 0; p < g_disk_pages; p++) pthread_mutex_init(&g_disk_locks[p], NULL);
+
+    printf("Disk table: %s, %zu pages of %d bytes (%.1f MB)\n",
+           g_disk_path ? g_disk_path : "temporary file", g_disk_pages, DISK_PAGE,
+           (double)bytes / (1024.0 * 1024.0));
+    return 0;
+}
+
+static void disk_cleanup(void) {
+    if (g_disk_map) munmap(g_disk_map, g_disk_pages * DISK_PAGE);
+    if (g_disk_locks) {
+        for (size_t p = 0; p < g_disk_pages; p++) pthread_mutex_destroy(&g_disk_locks[p]);
+    }
+    if (g_disk_fd >= 0) {
+        close(g_disk_fd);
+        if (g_disk_path && g_disk_unlink) unlink(g_disk_path);
+    }
+    free(g_disk_locks);
+    g_disk_map = NULL;
+    g_disk_locks = NULL;
+    g_disk_fd = -1;
+    g_disk_pages = g_disk_home_pages = 0;
+    g_live_keys = 0;
+}
+
+static size_t disk_capacity(void) {
+    return g_disk_map ? g_disk_home_pages * DISK_KEYS_PER_PAGE : 0;
+}
+
+static void disk_for_each_key(KeyVisitor visit, void *ctx) {
+    for (size_t p = 0; p < g_disk_pages; p++) {
+        const DiskPage *pg = disk_page(p);
+        for (size_t s = 0; s < pg->nslots; s++) {
+            if (pg->slot[s].off) {
+                visit((const char *)pg + pg->slot[s].off, pg->slot[s].len, p * DISK_MAX_SLOTS + s, ctx);
+            }
+        }
+    }
+}
+
+static int disk_begin_step(const char *action, int nthreads) {
+    (void)action;
+    (void)nthreads;
+    atomic_store(&d_page_visits, 0);
+    atomic_store(&d_keys, 0);
+    atomic_store(&d_workers_done, 0);
+    d_sync_ms = 0.0;
+    disk_io_counters(&d_minflt, &d_majflt, &d_read, &d_written);
+    return 0;
+}
+
+// Report faults and I/O per key; the writeback already happened inside
+// the step (disk_worker_done), so it is part of ExecutionTime
+static void disk_end_step(void) {
+    long minflt, majflt;
+    long long rd, wr;
+    disk_io_counters(&minflt, &majflt, &rd, &wr);
+    size_t keys = atomic_load(&d_keys);
+    size_t failed = atomic_exchange(&d_failed, 0);
+    if (failed) printf("Disk table full: %zu inserts dropped\n", failed);
+    if (keys == 0) return;
+
+    double k = (double)keys;
+    printf("Disk: %.3f page visits per key (sorted batches), %.4f faults per key (%ld major), ",
+           (double)atomic_load(&d_page_visits) / k, (double)(minflt - d_minflt + majflt - d_majflt) / k,
+           majflt - d_majflt);
+    if (rd >= 0 && d_read >= 0) {
+        printf("I/O %.1f B read / %.1f B written per key\n", (double)(rd - d_read) / k, (double)(wr - d_written) / k);
+    } else {
+        printf("I/O counters unavailable\n");
+    }
+    printf("Disk: msync %.2f ms of the step\n", d_sync_ms);
+}
+
+// The last worker of a step flushes the dirty pages, so the step's timing
+// includes its writeback and the I/O counters see it
+static void disk_worker_done(const WorkerArgs *wa) {
+    if (atomic_fetch_add(&d_workers_done, 1) + 1 != wa->nthreads || !g_disk_map) return;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    msync(g_disk_map, g_disk_pages * DISK_PAGE, MS_SYNC);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    d_sync_ms = (double)(t1.tv_sec - t0.tv_sec) * 1000.0 + (double)(t1.tv_nsec - t0.tv_nsec) / 1e6;
+}
+
+// Directory index of key in page pg, -1 if absent
+static int disk_page_find(const DiskPage *pg, const char *key, size_t length) {
+    for (size_t s = 0; s < pg->nslots; s++) {
+        const DiskSlot *ds = &pg->slot[s];
+        if (ds->off && ds->len == length && memcmp((const char *)pg + ds->off, key, length) == 0) {
+            return (int)s;
+        }
+    }
+    return -1;
+}
+
+// Repack the live keys of a page against its end; slots keep their numbers
+static void disk_page_compact(DiskPage *pg) {
+    char copy[DISK_PAGE];
+    memcpy(copy, pg, DISK_PAGE);
+    size_t end = DISK_PAGE;
+    for (size_t s = 0; s < pg->nslots; s++) {
+        DiskSlot *ds = &pg->slot[s];
+        if (!ds->off) continue;
+        end -= ds->len + 1;
+        memcpy((char *)pg + end, copy + ds->off, ds->len + 1);
+        ds->off = (uint16_t)end;
+    }
+    pg->key_start = (uint16_t)end;
+    pg->dead = 0;
+}
+
+// Store key in pg if it fits; returns its slot or -1
+static int disk_page_insert(DiskPage *pg, const char *key, size_t length) {
+    int s = 0;
+    while (s < pg->nslots && pg->slot[s].off) s++;
+    size_t dir_end = sizeof(DiskPage) + (size_t)(s == pg->nslots ? s + 1 : pg->nslots) * sizeof(DiskSlot);
+    if (s == DISK_MAX_SLOTS || dir_end + length + 1 > DISK_PAGE) return -1;
+
+    size_t start = disk_key_start(pg);
+    if (start < dir_end + length + 1) {
+        if (start + pg->dead < dir_end + length + 1) return -1;
+        disk_page_compact(pg);
+        start = pg->key_start;
+    }
+    start -= length + 1;
+    memcpy((char *)pg + start, key, length);
+    ((char *)pg)[start + length] = '\0';
+    pg->key_start = (uint16_t)start;
+    pg->slot[s].off = (uint16_t)start;
+    pg->slot[s].len = (uint16_t)length;
+    if (s == pg->nslots) pg->nslots++;
+    return s;
+}
+
+static int disk_op_cmp(const void *a, const void *b) {
+    const DiskOp *x = (const DiskOp *)a, *y = (const DiskOp *)b;
+    if (x->page != y->page) return x->page < y->page ? -1 : 1;
+    return x->item < y->item ? -1 : (x->item > y->item);
+}
+
+static void *disk_worker(void *arg) {
+    WorkerArgs *wa = (WorkerArgs *)arg;
+    int is_insert = strcmp(wa->action, "insert") == 0;
+    int is_lookup = strcmp(wa->action, "lookup") == 0;
+    size_t thread_collisions = 0, visits = 0, last_page = (size_t)-1;
+    long long live_delta = 0;
+
+    size_t n = wa->end - wa->start;
+    DiskOp *ops = (DiskOp *)malloc(n * sizeof(DiskOp));
+    if (!ops) {
+        perror("Memory allocation failed for disk batch");
+        for (size_t item = wa->start; item < wa->end; item++) wa->out_results[item] = 'F';
+        *(wa->collision_count) = 0;
+        disk_worker_done(wa);
+        return NULL;
+    }
+    for (size_t i = 0; i < n; i++) {
+        const StringMetadata *m = &wa->meta[wa->start + i];
+        ops[i] = (DiskOp){ fnv1a64(m->ptr, m->length) % g_disk_home_pages, wa->start + i };
+    }
+    qsort(ops, n, sizeof(DiskOp), disk_op_cmp);
+
+    for (size_t i = 0; i < n; i++) {
+        size_t item = ops[i].item, home = ops[i].page;
+        const char *key = wa->meta[item].ptr;
+        size_t length = wa->meta[item].length;
+        if (home != last_page) visits++;
+        last_page = home;
+
+        // Search the chain: home page, then on while pages have overflowed
+        pthread_mutex_lock(&g_disk_locks[home]);
+        size_t p = home;
+        int s = -1;
+        while (1) {
+            if (p != home) pthread_mutex_lock(&g_disk_locks[p]);
+            DiskPage *pg = disk_page(p);
+            s = disk_page_find(pg, key, length);
+            if (s >= 0 && !is_insert && !is_lookup) {
+                pg->dead += pg->slot[s].len + 1;
+                pg->slot[s].off = 0;
+                while (pg->nslots > 0 && !pg->slot[pg->nslots - 1].off) pg->nslots--;
+                if (pg->nslots == 0) pg->key_start = pg->dead = 0;
+                live_delta--;
+            }
+            int more = s < 0 && pg->overflow && p + 1 < g_disk_pages;
+            if (p != home) pthread_mutex_unlock(&g_disk_locks[p]);
+            if (!more) break;
+            p++;
+            visits++;
+            thread_collisions++;
+        }
+
+        if (s >= 0) {
+            wa->out_indices[item] = p * DISK_MAX_SLOTS + (size_t)s;
+            wa->out_results[item] = 'T';
+        } else {
+            wa->out_results[item] = 'F';
+            if (is_insert) {
+                // Not present: first page of the chain with room
+                for (p = home; p < g_disk_pages; p++) {
+                    if (p != home) {
+                        pthread_mutex_lock(&g_disk_locks[p]);
+                        visits++;
+                        thread_collisions++;
+                    }
+                    DiskPage *pg = disk_page(p);
+                    s = disk_page_insert(pg, key, length);
+                    if (s < 0) pg->overflow = 1;
+                    if (p != home) pthread_mutex_unlock(&g_disk_locks[p]);
+                    if (s >= 0) break;
+                }
+                if (s >= 0) {
+                    wa->out_indices[item] = p * DISK_MAX_SLOTS + (size_t)s;
+                    live_delta++;
+                } else {
+                    atomic_fetch_add(&d_failed, 1);
+                }
+            }
+        }
+        pthread_mutex_unlock(&g_disk_locks[home]);
+
+        size_t processed = i + 1;
+        if (processed % PROGRESS_PUBLISH_INTERVAL == 0 || processed == n) {
+            atomic_store_explicit(&wa->progress->keys_done, processed, memory_order_relaxed);
+            atomic_store_explicit(&wa->progress->collisions, thread_collisions, memory_order_relaxed);
+            atomic_store_explicit(&wa->progress->live_delta, live_delta, memory_order_relaxed);
+        }
+    }
+
+    free(ops);
+    atomic_fetch_add(&d_page_visits, visits);
+    atomic_fetch_add(&d_keys, n);
+    *(wa->collision_count) = thread_collisions;
+    disk_worker_done(wa);
+    return NULL;
+}
+
+// Worker thread function
+static void *worker(void *arg) {
+    WorkerArgs *workerArg = (WorkerArgs *)arg;
+    size_t thread_collisions = 0;
+    long long live_delta = 0;
+    HotCache *hc = workerArg->thread_id < g_hot_threads ? &g_hot_caches[workerArg->thread_id] : NULL;
+    int is_insert = strcmp(workerArg->action, "insert") == 0;
+    int is_delete = strcmp(workerArg->action, "delete") == 0;
+
+    for (size_t itemIndex = workerArg->start; itemIndex < workerArg->end; ++itemIndex) {
+        const char *currentString = workerArg->meta[itemIndex].ptr;
+        size_t stringLength = workerArg->meta[itemIndex].length;
+
+        uint64_t hash = fnv1a64(currentString, stringLength);
+        size_t tablePos = hash % g_table_size;
+        size_t first_tombstone = (size_t)(-1);
+        size_t local_collisions = 0;
+        int cached = hc && hot_answer(hc, workerArg, itemIndex, hash, currentString, stringLength,
+                                      is_insert, is_delete, &thread_collisions);
+
+        if (cached) {
+            // Answered by this thread's hot-key cache
+        } else if (is_insert) {
+            // Insert operation
+            while (1) {
+                pthread_mutex_lock(&bucketLocks[tablePos]);
+                HashEntry *e = &g_table[tablePos];
+
+                if (e->key == NULL) {
+                    if (e->tombstone) {
+                        // Found tombstone, remember first one
+                        if (first_tombstone == (size_t)(-1)) {
+                            first_tombstone = tablePos;
+                        }
+                        pthread_mutex_unlock(&bucketLocks[tablePos]);
+                    } else {
+                        // Empty slot - use either first tombstone or this slot
+                        size_t target = (first_tombstone == (size_t)(-1)) ? tablePos : first_tombstone;
+                        if (target != tablePos) {
+                            pthread_mutex_unlock(&bucketLocks[tablePos]);
+                            pthread_mutex_lock(&bucketLocks[target]);
+                            if (g_table[target].key != NULL) {
+                                // Tombstone was reused by another thread (possibly
+                                // for this very key) - restart the probe from home
+                                pthread_mutex_unlock(&bucketLocks[target]);
+                                tablePos = hash % g_table_size;
+                                first_tombstone = (size_t)(-1);
+                                local_collisions = 0;
+                                continue;
+                            }
+                        }
+
+                        if (workerArg->key_source) {
+                            // Zero-copy: reference the record in the input buffer
+                            g_table[target].key = &workerArg->meta[itemIndex];
+                            g_table[target].source = (uint8_t)workerArg->key_source;
+                            workerArg->source_refs[workerArg->key_source - 1]++;
+                        } else {
+                            g_table[target].key = malloc(sizeof(StringMetadata));
+                            if (g_table[target].key) {
+                                g_table[target].key->ptr = malloc(stringLength + 1);
+                                if (g_table[target].key->ptr) {
+                                    memcpy(g_table[target].key->ptr, currentString, stringLength);
+                                    g_table[target].key->ptr[stringLength] = '\0';
+                                    g_table[target].key->length = stringLength;
+                                } else {
+                                    free(g_table[target].key);
+                                    g_table[target].key = NULL;
+                                }
+                            }
+                        }
+                        g_table[target].tombstone = 0;
+                        workerArg->out_indices[itemIndex] = target;
+                        workerArg->out_results[itemIndex] = 'F'; // did not exist
+                        live_delta++;
+                        thread_collisions += local_collisions;
+                        pthread_mutex_unlock(&bucketLocks[target]);
+                        break;
+                    }
+                } else if (e->key->length == stringLength && 
+                          memcmp(e->key->ptr, currentString, stringLength) == 0) {
+                    // Key already exists
+                    workerArg->out_indices[itemIndex] = tablePos;
+                    workerArg->out_results[itemIndex] = 'T'; // existed
+                    pthread_mutex_unlock(&bucketLocks[tablePos]);
+                    break;
+                } else {
+                    // Different key, continue probing
+                    pthread_mutex_unlock(&bucketLocks[tablePos]);
+                    // Don't count collisions after first tombstone found
+                    if (first_tombstone == (size_t)(-1)) local_collisions++;
+                }
+                tablePos = (tablePos + 1) % g_table_size;
+            }
+        } else if (!is_delete) {
+            // Read-only lookup, the live-table baseline for a frozen index
+            while (1) {
+                pthread_mutex_lock(&bucketLocks[tablePos]);
+                HashEntry *e = &g_table[tablePos];
+
+                if (e->key == NULL && !e->tombstone) {
+                    workerArg->out_results[itemIndex] = 'F'; // not found
+                    pthread_mutex_unlock(&bucketLocks[tablePos]);
+                    break;
+                } else if (e->key && e->key->length == stringLength &&
+                          memcmp(e->key->ptr, currentString, stringLength) == 0) {
+                    workerArg->out_indices[itemIndex] = tablePos;
+                    workerArg->out_results[itemIndex] = 'T'; // found
+                    thread_collisions += local_collisions;
+                    pthread_mutex_unlock(&bucketLocks[tablePos]);
+                    break;
+                }
+                pthread_mutex_unlock(&bucketLocks[tablePos]);
+                local_collisions++;
+                tablePos = (tablePos + 1) % g_table_size;
+            }
+        } else {
+            // Delete operation
+            while (1) {
+                pthread_mutex_lock(&bucketLocks[tablePos]);
+                HashEntry *e = &g_table[tablePos];
+
+                if (e->key == NULL) {
+                    if (e->tombstone) {
+                        // Keep probing past tombstones
+                        pthread_mutex_unlock(&bucketLocks[tablePos]);
+                        local_collisions++;
+                    } else {
+                        // Empty bucket - key not found
+                        workerArg->out_results[itemIndex] = 'F'; // not found
+                        pthread_mutex_unlock(&bucketLocks[tablePos]);
+                        break;
+                    }
+                } else if (e->key->length == stringLength && 
+                          memcmp(e->key->ptr, currentString, stringLength) == 0) {
+                    // Found key - delete it
+                    if (e->source) {
+                        workerArg->source_refs[e->source - 1]--;
+                        e->source = 0;
+                    } else {
+                        free(e->key->ptr);
+                        free(e->key);
+                    }
+                    e->key = NULL;
+                    e->tombstone = 1;
+                    workerArg->out_indices[itemIndex] = tablePos;
+                    workerArg->out_results[itemIndex] = 'T'; // found and deleted
+                    thread_collisions += local_collisions;
+                    live_delta--;
+                    pthread_mutex_unlock(&bucketLocks[tablePos]);
+                    break;
+                } else {
+                    // Different key, continue probing
+                    pthread_mutex_unlock(&bucketLocks[tablePos]);
+                    local_collisions++;
+                }
+
+                tablePos = (tablePos + 1) % g_table_size;
+            }
+        }
+        if (hc && !cached) {
+            hot_fill(hc, workerArg, itemIndex, hash, currentString, stringLength, is_insert, is_delete);
+        }
+
+        // Publish progress periodically; relaxed stores to a thread-private line
+        size_t done = itemIndex - workerArg->start + 1;
+        if (done % PROGRESS_PUBLISH_INTERVAL == 0 || itemIndex + 1 == workerArg->end) {
+            ThreadProgress *p = workerArg->progress;
+            atomic_store_explicit(&p->keys_done, done, memory_order_relaxed);
+            atomic_store_explicit(&p->collisions, thread_collisions, memory_order_relaxed);
+            atomic_store_explicit(&p->live_delta, live_delta, memory_order_relaxed);
+        }
+    }
+
+    *(workerArg->collision_count) = thread_collisions;
+    return NULL;
+}
+
+static double elapsed_seconds(const struct timespec *from, const struct timespec *to) {
+    return (double)(to->tv_sec - from->tv_sec) + (double)(to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+// Write one sample in Prometheus textfile format. Written to a temporary file
+// and renamed so node_exporter never scrapes a half-written file.
+static void progress_write_metrics(const ProgressReporter *rep, size_t done, size_t collisions,
+                                   double load_factor, double ops_per_sec) {
+    char tmp[1024];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", rep->args->metrics_file);
+    FILE *out = fopen(tmp, "w");
+    if (!out) {
+        perror("Cannot open metrics file");
+        return;
+    }
+
+    fprintf(out, "# HELP hw2_keys_done Keys processed in the current flow step.\n");
+    fprintf(out, "# TYPE hw2_keys_done gauge\n");
+    for (int t = 0; t < rep->nthreads; ++t) {
+        fprintf(out, "hw2_keys_done{step=\"%d\",action=\"%s\",thread=\"%d\"} %zu\n",
+                rep->op_index, rep->action, t,
+                atomic_load_explicit(&rep->slots[t].keys_done, memory_order_relaxed));
+    }
+    fprintf(out, "# HELP hw2_step_keys_total Keys in the current flow step.\n");
+    fprintf(out, "# TYPE hw2_step_keys_total gauge\n");
+    fprintf(out, "hw2_step_keys_total{step=\"%d\",action=\"%s\"} %zu\n",
+            rep->op_index, rep->action, rep->total_keys);
+    fprintf(out, "# HELP hw2_step_keys_done_total Keys processed by all threads in the current step.\n");
+    fprintf(out, "# TYPE hw2_step_keys_done_total gauge\n");
+    fprintf(out, "hw2_step_keys_done_total{step=\"%d\",action=\"%s\"} %zu\n",
+            rep->op_index, rep->action, done);
+    fprintf(out, "# HELP hw2_collisions Collisions handled in the current flow step.\n");
+    fprintf(out, "# TYPE hw2_collisions gauge\n");
+    fprintf(out, "hw2_collisions{step=\"%d\",action=\"%s\"} %zu\n",
+            rep->op_index, rep->action, collisions);
+    fprintf(out, "# HELP hw2_load_factor Live keys divided by table size.\n");
+    fprintf(out, "# TYPE hw2_load_factor gauge\n");
+    fprintf(out, "hw2_load_factor %.6f\n", load_factor);
+    fprintf(out, "# HELP hw2_ops_per_second Operations per second over the last sample interval.\n");
+    fprintf(out, "# TYPE hw2_ops_per_second gauge\n");
+    fprintf(out, "hw2_ops_per_second %.1f\n", ops_per_sec);
+
+    if (fclose(out) != 0 || rename(tmp, rep->args->metrics_file) != 0) {
+        perror("Cannot publish metrics file");
+    }
+}
+
+// Sum the per-thread counters and report them
+static void progress_sample(ProgressReporter *rep) {
+    size_t done = 0, collisions = 0;
+    long long live_delta = 0;
+    for (int t = 0; t < rep->nthreads; ++t) {
+        done += atomic_load_explicit(&rep->slots[t].keys_done, memory_order_relaxed);
+        collisions += atomic_load_explicit(&rep->slots[t].collisions, memory_order_relaxed);
+        live_delta += atomic_load_explicit(&rep->slots[t].live_delta, memory_order_relaxed);
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double interval = elapsed_seconds(&rep->last_sample, &now);
+    double ops_per_sec = interval > 0 ? (double)(done - rep->last_done) / interval : 0.0;
+    double load_factor = (double)((long long)g_live_keys + live_delta) / (double)g_engine->capacity();
+
+    fprintf(stderr, "[progress] step %d/%d %s: %zu/%zu keys (%.1f%%), %zu collisions, "
+            "load %.3f, %.0f ops/s, %.2fs elapsed\n",
+            rep->op_index + 1, rep->args->num_operations, rep->action, done, rep->total_keys,
+            rep->total_keys ? 100.0 * (double)done / (double)rep->total_keys : 100.0,
+            collisions, load_factor, ops_per_sec, elapsed_seconds(&rep->step_start, &now));
+
+    if (rep->args->metrics_file) {
+        progress_write_metrics(rep, done, collisions, load_factor, ops_per_sec);
+    }
+
+    rep->last_sample = now;
+    rep->last_done = done;
+}
+
+// Reporter thread: sample every progress_ms until told to stop
+static void *progress_thread(void *arg) {
+    ProgressReporter *rep = (ProgressReporter *)arg;
+
+    pthread_mutex_lock(&rep->lock);
+    while (!rep->stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += rep->args->progress_ms / 1000;
+        deadline.tv_nsec += (rep->args->progress_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        int rc = 0;
+        while (!rep->stop && rc != ETIMEDOUT) {
+            rc = pthread_cond_timedwait(&rep->cond, &rep->lock, &deadline);
+        }
+        if (rep->stop) break;
+
+        pthread_mutex_unlock(&rep->lock);
+        progress_sample(rep);
+        pthread_mutex_lock(&rep->lock);
+    }
+    pthread_mutex_unlock(&rep->lock);
+    return NULL;
+}
+
+// Start sampling a flow step. A no-op unless --progress_ms was given.
+static int progress_start(ProgressReporter *rep, const ProgramArgs *args, int op_index,
+                          const char *action, size_t total_keys,
+                          ThreadProgress *slots, int nthreads) {
+    memset(rep, 0, sizeof(*rep));
+    if (args->progress_ms <= 0) return 0;
+
+    rep->args = args;
+    rep->op_index = op_index;
+    rep->action = action;
+    rep->total_keys = total_keys;
+    rep->slots = slots;
+    rep->nthreads = nthreads;
+    clock_gettime(CLOCK_MONOTONIC, &rep->step_start);
+    rep->last_sample = rep->step_start;
+
+    pthread_mutex_init(&rep->lock, NULL);
+    pthread_cond_init(&rep->cond, NULL);
+    if (pthread_create(&rep->thread, NULL, progress_thread, rep) != 0) {
+        perror("Unable to start progress reporter");
+        pthread_mutex_destroy(&rep->lock);
+        pthread_cond_destroy(&rep->cond);
+        rep->args = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// Stop the reporter and emit a final sample for the step
+static void progress_stop(ProgressReporter *rep) {
+    if (!rep->args) return;
+
+    pthread_mutex_lock(&rep->lock);
+    rep->stop = 1;
+    pthread_cond_signal(&rep->cond);
+    pthread_mutex_unlock(&rep->lock);
+    pthread_join(rep->thread, NULL);
+
+    progress_sample(rep);
+
+    pthread_mutex_destroy(&rep->lock);
+    pthread_cond_destroy(&rep->cond);
+    rep->args = NULL;
+}
+
+// Buffer pool: per-step arrays are retained and reused across flow steps
+// instead of being malloc'd and freed each time. A buffer only grows (by at
+// least half again) and is pre-faulted when it does, so steady-state steps
+// neither allocate nor take page faults on fresh memory.
+typedef enum {
+    POOL_INDICES,
+    POOL_RESULTS,
+    POOL_THREADS,
+    POOL_WARGS,
+    POOL_COLLISIONS,
+    POOL_PROGRESS,
+    POOL_METADATA,
+    POOL_DATA,
+    POOL_SOURCE_REFS,
+    POOL_COUNT
+} PoolSlot;
+
+typedef struct {
+    void *ptr;
+    size_t size;
+} PoolBuffer;
+
+static PoolBuffer g_pool[POOL_COUNT];
+static size_t g_pool_grows = 0;
+
+// Return at least size bytes for slot, zero-filled if zero is set, aligned
+// to a cache line. The buffer stays owned by the pool; NULL on allocation failure.
+static void *pool_get(PoolSlot slot, size_t size, int zero) {
+    PoolBuffer *b = &g_pool[slot];
+    if (size == 0) size = 1;
+
+    if (size > b->size) {
+        size_t new_size = b->size + b->size / 2;
+        if (new_size < size) new_size = size;
+        new_size = (new_size + 63) & ~(size_t)63;  // aligned_alloc wants a multiple of the alignment
+
+        free(b->ptr);
+        b->ptr = aligned_alloc(64, new_size);
+        if (!b->ptr) {
+            b->size = 0;
+            return NULL;
+        }
+        b->size = new_size;
+        g_pool_grows++;
+        memset(b->ptr, 0, new_size);  // pre-fault every page once
+        return b->ptr;
+    }
+
+    if (zero) memset(b->ptr, 0, size);
+    return b->ptr;
+}
+
+static void pool_release_all(void) {
+    size_t retained = 0;
+    for (int i = 0; i < POOL_COUNT; i++) {
+        retained += g_pool[i].size;
+        free(g_pool[i].ptr);
+        g_pool[i].ptr = NULL;
+        g_pool[i].size = 0;
+    }
+    if (g_pool_grows) {
+        printf("Buffer pool: %zu grows, %.1f MB retained at peak\n",
+               g_pool_grows, (double)retained / (1024.0 * 1024.0));
+    }
+    g_pool_grows = 0;
+}
+
+int preprocess(const char *filename, size_t *lineCount, size_t *totalDataSize) {
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        perror("Error opening file");
+        return 1;
+    }
+
+    char line[1024];
+    *lineCount = 0;
+    *totalDataSize = 0;
+
+    while (fgets(line, sizeof(line), file)) {
+        (*lineCount)++;
+        *totalDataSize += strlen(line);
+    }
+
+    fclose(file);
+    return 0;
+}
+
+int allocate_memory(size_t lineCount, size_t totalDataSize, StringMetadata **metadata, char **data) {
+    *metadata = (StringMetadata *)malloc(lineCount * sizeof(StringMetadata));
+    if (!*metadata) {
+        perror("Memory allocation failed for metadata");
+        return 1;
+    }
+
+    *data = (char *)malloc(totalDataSize + 1);
+    if (!*data) {
+        perror("Memory allocation failed for data");
+        free(*metadata);
+        return 1;
+    }
+
+    return 0;
+}
+
+int read_data(const char *filename, size_t lineCount, StringMetadata *metadata, char *data) {
+    FILE *file = fopen(filename, "r");
+    if (!file) {
+        perror("Error opening file");
+        return 1;
+    }
+
+    char line[1024];
+    size_t totalDataAllocated = 0;
+    size_t totalStrings = 0;
+
+    while (fgets(line, sizeof(line), file) && totalStrings < lineCount) {
+        size_t len = strlen(line);
+        if (line[len - 1] == '\n') {
+            line[len - 1] = '\0';
+            len--;
+        }
+
+        memcpy(data + totalDataAllocated, line, len);
+        data[totalDataAllocated + len] = '\0';
+
+        metadata[totalStrings].ptr = data + totalDataAllocated;
+        metadata[totalStrings].length = len;
+
+        totalDataAllocated += len + 1;
+        totalStrings++;
+    }
+
+    fclose(file);
+    return 0;
+}
+
+// Incremental line indexer for the chunked readers. The whole file is read
+// into data, so replacing each '\n' with '\0' in place gives exactly the
+// layout read_data() builds.
+typedef struct {
+    StringMetadata *metadata;
+    size_t count;
+    size_t capacity;
+    char *data;
+    size_t indexed;            // bytes of data already split into lines
+} LineIndexer;
+
+// Index all complete lines in data[indexed, upto); at end of file the
+// trailing line without a newline is taken too
+static int index_lines(LineIndexer *ix, size_t upto, int at_eof) {
+    while (ix->indexed < upto) {
+        char *start = ix->data + ix->indexed;
+        char *nl = (char *)g_kernels.scan_newline(start, upto - ix->indexed);
+        if (!nl && !at_eof) break;
+
+        size_t len = nl ? (size_t)(nl - start) : upto - ix->indexed;
+        if (ix->count == ix->capacity) {
+            size_t capacity = ix->capacity ? ix->capacity * 2 : 4096;
+            StringMetadata *grown = (StringMetadata *)realloc(ix->metadata, capacity * sizeof(StringMetadata));
+            if (!grown) {
+                perror("Memory allocation failed for metadata");
+                return 1;
+            }
+            ix->metadata = grown;
+            ix->capacity = capacity;
+        }
+
+        start[len] = '\0';
+        ix->metadata[ix->count].ptr = start;
+        ix->metadata[ix->count].length = len;
+        ix->count++;
+        ix->indexed += len + (nl ? 1 : 0);
+    }
+    return 0;
+}
+
+// Minimal io_uring ring, driven through raw syscalls (no liburing)
+typedef struct {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+} Uring;
+
+static int uring_setup(Uring *ring, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(ring, 0, sizeof(*ring));
+
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd < 0) return -1;
+
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        close(ring->fd);
+        return -1;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            munmap(ring->sq_ring, ring->sq_ring_size);
+            close(ring->fd);
+            return -1;
+        }
+    }
+
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                                             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        if (ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+        munmap(ring->sq_ring, ring->sq_ring_size);
+        close(ring->fd);
+        return -1;
+    }
+
+    char *sq = (char *)ring->sq_ring, *cq = (char *)ring->cq_ring;
+    ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+static void uring_teardown(Uring *ring) {
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+// Queue a read of len bytes at offset into buf; user_data identifies it
+static void uring_queue_read(Uring *ring, int fd, char *buf, unsigned len, off_t offset, uint64_t user_data) {
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = (uint64_t)offset;
+    sqe->user_data = user_data;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+// Per-chunk bookkeeping for the uring reader
+typedef struct {
+    size_t offset;
+    size_t length;
+    size_t done;               // bytes completed so far
+} ReadChunk;
+
+// Read fd (size bytes) into ix->data with up to URING_QUEUE_DEPTH chunk
+// reads in flight, indexing lines as the contiguous prefix completes.
+// Returns -2 if io_uring is unavailable so the caller can fall back.
+static int read_file_uring(int fd, size_t size, LineIndexer *ix) {
+    Uring ring;
+    if (uring_setup(&ring, URING_QUEUE_DEPTH) != 0) return -2;
+
+    size_t nchunks = (size + READ_CHUNK_SIZE - 1) / READ_CHUNK_SIZE;
+    ReadChunk *chunks = (ReadChunk *)calloc(nchunks ? nchunks : 1, sizeof(ReadChunk));
+    if (!chunks) {
+        perror("Memory allocation failed for read chunks");
+        uring_teardown(&ring);
+        return 1;
+    }
+    for (size_t c = 0; c < nchunks; c++) {
+        chunks[c].offset = c * READ_CHUNK_SIZE;
+        chunks[c].length = (c + 1 == nchunks) ? size - chunks[c].offset : READ_CHUNK_SIZE;
+    }
+
+    size_t next_submit = 0, next_index = 0, inflight = 0;
+    int rc = 0;
+
+    while (next_index < nchunks && rc == 0) {
+        unsigned to_submit = 0;
+        while (inflight < URING_QUEUE_DEPTH && next_submit < nchunks) {
+            ReadChunk *ch = &chunks[next_submit];
+            uring_queue_read(&ring, fd, ix->data + ch->offset, (unsigned)ch->length,
+                             (off_t)ch->offset, next_submit);
+            next_submit++;
+            inflight++;
+            to_submit++;
+        }
+
+        if (syscall(__NR_io_uring_enter, ring.fd, to_submit, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+            if (errno == EINTR) continue;
+            rc = (next_index == 0 && chunks[0].done == 0) ? -2 : 1;
+            break;
+        }
+
+        unsigned head = *ring.cq_head;
+        while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+            struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cq_mask];
+            ReadChunk *ch = &chunks[cqe->user_data];
+            head++;
+            inflight--;
+
+            if (cqe->res < 0) {
+                // Kernels without IORING_OP_READ reject it up front; fall back
+                rc = (cqe->res == -EINVAL && next_index == 0) ? -2 : 1;
+                if (rc == 1) fprintf(stderr, "Error reading input: %s\n", strerror(-cqe->res));
+                continue;
+            }
+            if (cqe->res == 0) {
+                fprintf(stderr, "Error reading input: file shrank while reading\n");
+                rc = 1;
+                continue;
+            }
+
+            ch->done += (size_t)cqe->res;
+            if (ch->done < ch->length && rc == 0) {
+                // Short read: queue the remainder of this chunk
+                uring_queue_read(&ring, fd, ix->data + ch->offset + ch->done,
+                                 (unsigned)(ch->length - ch->done), (off_t)(ch->offset + ch->done),
+                                 cqe->user_data);
+                inflight++;
+                if (syscall(__NR_io_uring_enter, ring.fd, 1, 0, 0, NULL, 0) < 0) rc = 1;
+            }
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+
+        // Feed the completed contiguous prefix to the indexer
+        size_t frontier = next_index;
+        while (frontier < nchunks && chunks[frontier].done == chunks[frontier].length) frontier++;
+        if (frontier != next_index && rc == 0) {
+            size_t upto = (frontier == nchunks) ? size : chunks[frontier].offset;
+            rc = index_lines(ix, upto, frontier == nchunks);
+            next_index = frontier;
+        }
+    }
+
+    // Drain reads still in flight before the buffers go away
+    while (inflight > 0) {
+        if (syscall(__NR_io_uring_enter, ring.fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR) break;
+        unsigned head = *ring.cq_head;
+        while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+            head++;
+            inflight--;
+        }
+        __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    free(chunks);
+    uring_teardown(&ring);
+    return rc;
+}
+
+// Blocking fallback: the same chunking with pread
+static int read_file_pread(int fd, size_t size, LineIndexer *ix) {
+    size_t offset = 0;
+    while (offset < size) {
+        size_t want = size - offset < READ_CHUNK_SIZE ? size - offset : READ_CHUNK_SIZE;
+        ssize_t got = pread(fd, ix->data + offset, want, (off_t)offset);
+        if (got < 0) {
+            if (errno == EINTR) continue;
+            perror("Error reading input");
+            return 1;
+        }
+        if (got == 0) {
+            fprintf(stderr, "Error reading input: file shrank while reading\n");
+            return 1;
+        }
+        offset += (size_t)got;
+        if (index_lines(ix, offset, offset == size) != 0) return 1;
+    }
+    return 0;
+}
+
+// Load a whole file with the chunked readers into ds. reader is "uring" or
+// "pread"; *used names the reader that actually ran.
+static int read_dataset_chunked(Dataset *ds, const char *reader, const char **used) {
+    int fd = open(ds->path, O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening file");
+        return 1;
+    }
+
+    size_t size = (size_t)ds->file_size;
+    LineIndexer ix;
+    memset(&ix, 0, sizeof(ix));
+    ix.data = (char *)malloc(size + 1);
+    if (!ix.data) {
+        perror("Memory allocation failed for data");
+        close(fd);
+        return 1;
+    }
+    ix.data[size] = '\0';
+
+    int rc = -2;
+    *used = "pread";
+    if (strcmp(reader, "uring") == 0) {
+        rc = read_file_uring(fd, size, &ix);
+        if (rc == -2) {
+            fprintf(stderr, "io_uring unavailable, falling back to pread\n");
+            ix.count = 0;
+            ix.indexed = 0;
+        } else {
+            *used = "io_uring";
+        }
+    }
+    if (rc == -2) rc = read_file_pread(fd, size, &ix);
+    if (rc == 0 && size == 0) rc = index_lines(&ix, 0, 1);
+    close(fd);
+
+    if (rc != 0) {
+        free(ix.metadata);
+        free(ix.data);
+        return 1;
+    }
+
+    ds->lineCount = ix.count;
+    ds->metadata = ix.metadata;
+    ds->data = ix.data;
+    ds->bytes = ix.capacity * sizeof(StringMetadata) + size + 1;
+    return 0;
+}
+
+// Gzip input: a decompression thread inflates the file (all members) into a
+// queue of fixed-size chunks while the loading thread appends each finished
+// chunk to the dataset buffer and indexes it. Queued chunks never move, so
+// the lock only guards the queue links; copying and indexing run outside it,
+// and only the loader grows (and rebases) the dataset buffer.
+typedef struct GzipChunk {
+    struct GzipChunk *next;
+    size_t len;
+    char bytes[];
+} GzipChunk;
+
+typedef struct {
+    const char *path;
+    GzipChunk *head, *tail;    // inflated chunks waiting for the loader
+    GzipChunk *spare;          // drained chunks handed back for reuse
+    int done;                  // producer finished
+    int error;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} GzipFeed;
+
+static GzipChunk *gzip_chunk_get(GzipFeed *feed) {
+    pthread_mutex_lock(&feed->lock);
+    GzipChunk *chunk = feed->spare;
+    if (chunk) feed->spare = chunk->next;
+    pthread_mutex_unlock(&feed->lock);
+
+    if (!chunk) chunk = (GzipChunk *)malloc(sizeof(GzipChunk) + READ_CHUNK_SIZE);
+    if (chunk) {
+        chunk->next = NULL;
+        chunk->len = 0;
+    }
+    return chunk;
+}
+
+static void gzip_chunk_push(GzipFeed *feed, GzipChunk *chunk) {
+    pthread_mutex_lock(&feed->lock);
+    if (feed->tail) feed->tail->next = chunk;
+    else feed->head = chunk;
+    feed->tail = chunk;
+    pthread_cond_signal(&feed->cond);
+    pthread_mutex_unlock(&feed->lock);
+}
+
+static void gzip_chunk_free_list(GzipChunk *chunk) {
+    while (chunk) {
+        GzipChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+}
+
+static void *gzip_inflate_thread(void *arg) {
+    GzipFeed *feed = (GzipFeed *)arg;
+    int fd = open(feed->path, O_RDONLY);
+    unsigned char *in = (unsigned char *)malloc(READ_CHUNK_SIZE);
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    int error = (fd < 0 || !in || inflateInit2(&zs, 15 + 32) != Z_OK);
+    int ended = 0;             // last inflate finished a member
+    GzipChunk *chunk = NULL;
+
+    while (!error) {
+        ssize_t got = read(fd, in, READ_CHUNK_SIZE);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) {
+            error = (got < 0);
+            break;
+        }
+        zs.next_in = in;
+        zs.avail_in = (unsigned)got;
+
+        // Keep going while input remains or inflate may still hold output
+        int drain = 1;
+        while ((zs.avail_in > 0 || drain) && !error) {
+            if (!chunk && !(chunk = gzip_chunk_get(feed))) {
+                error = 1;
+                break;
+            }
+            zs.next_out = (unsigned char *)chunk->bytes + chunk->len;
+            zs.avail_out = (unsigned)(READ_CHUNK_SIZE - chunk->len);
+            unsigned avail_in = zs.avail_in, avail_out = zs.avail_out;
+            int zrc = inflate(&zs, Z_NO_FLUSH);
+            chunk->len += avail_out - zs.avail_out;
+            ended = (zrc == Z_STREAM_END);
+            drain = (!ended && zs.avail_out == 0);
+
+            if (zrc == Z_BUF_ERROR && zs.avail_in == avail_in && zs.avail_out == avail_out) {
+                if (avail_in > 0) {
+                    fprintf(stderr, "Error decompressing %s: no progress\n", feed->path);
+                    error = 1;
+                }
+                drain = 0;
+            } else if (zrc == Z_STREAM_END) {
+                inflateReset(&zs);  // next member of a multi-member file
+            } else if (zrc != Z_OK && zrc != Z_BUF_ERROR) {
+                fprintf(stderr, "Error decompressing %s: %s\n", feed->path, zs.msg ? zs.msg : "corrupt data");
+                error = 1;
+            }
+
+            if (chunk->len == READ_CHUNK_SIZE) {
+                gzip_chunk_push(feed, chunk);
+                chunk = NULL;
+            }
+        }
+    }
+
+    // A complete file ends exactly at the end of a member
+    if (!error && !ended) {
+        fprintf(stderr, "Error decompressing %s: truncated or incomplete gzip stream\n", feed->path);
+        error = 1;
+    }
+    if (chunk && chunk->len > 0) gzip_chunk_push(feed, chunk);
+    else free(chunk);
+
+    inflateEnd(&zs);
+    free(in);
+    if (fd >= 0) close(fd);
+
+    pthread_mutex_lock(&feed->lock);
+    feed->error = error;
+    feed->done = 1;
+    pthread_cond_signal(&feed->cond);
+    pthread_mutex_unlock(&feed->lock);
+    return NULL;
+}
+
+// Grow the loader's buffer to hold want bytes, rebasing the lines indexed so far
+static int gzip_buffer_reserve(LineIndexer *ix, size_t *size, size_t want) {
+    if (want <= *size) return 0;
+
+    size_t grown_size = *size * 2;
+    if (grown_size < want) grown_size = want;
+    uintptr_t old_base = (uintptr_t)ix->data;
+    char *grown = (char *)realloc(ix->data, grown_size + 1);
+    if (!grown) {
+        perror("Memory allocation failed for data");
+        return 1;
+    }
+
+    for (size_t i = 0; i < ix->count; i++) {
+        ix->metadata[i].ptr = grown + ((uintptr_t)ix->metadata[i].ptr - old_base);
+    }
+    ix->data = grown;
+    *size = grown_size;
+    return 0;
+}
+
+// Load a gzip-compressed file into ds
+static int read_dataset_gzip(Dataset *ds) {
+    LineIndexer ix;
+    memset(&ix, 0, sizeof(ix));
+
+    // Preallocate from the ISIZE trailer (exact for single-member files
+    // < 4 GiB). A truncated or concatenated file ends in arbitrary bytes,
+    // so a trailer implying an implausible ratio only falls back to the
+    // ratio guess; the buffer grows if either is short.
+    size_t guess = (size_t)ds->file_size * GZIP_GUESS_RATIO;
+    int fd = open(ds->path, O_RDONLY);
+    if (fd < 0) {
+        perror("Error opening file");
+        return 1;
+    }
+    unsigned char trailer[4];
+    if (ds->file_size >= 18 && pread(fd, trailer, 4, ds->file_size - 4) == 4) {
+        size_t isize = (size_t)trailer[0] | (size_t)trailer[1] << 8 |
+                       (size_t)trailer[2] << 16 | (size_t)trailer[3] << 24;
+        if (isize > guess / 8 && isize <= (size_t)ds->file_size * GZIP_ISIZE_MAX_RATIO) guess = isize;
+    }
+    close(fd);
+
+    size_t size = guess + READ_CHUNK_SIZE;
+    ix.data = (char *)malloc(size + 1);
+    if (!ix.data) {
+        perror("Memory allocation failed for data");
+        return 1;
+    }
+    GzipFeed feed = { .path = ds->path };
+    pthread_mutex_init(&feed.lock, NULL);
+    pthread_cond_init(&feed.cond, NULL);
+
+    pthread_t thread;
+    if (spawn_thread(&thread, gzip_inflate_thread, &feed) != 0) {
+        perror("Unable to start decompression thread");
+        free(ix.data);
+        return 1;
+    }
+
+    // Index while the producer inflates; only taking a chunk needs the lock
+    int rc = 0;
+    size_t produced = 0;
+    while (rc == 0) {
+        pthread_mutex_lock(&feed.lock);
+        while (!feed.head && !feed.done) {
+            pthread_cond_wait(&feed.cond, &feed.lock);
+        }
+        GzipChunk *chunk = feed.head;
+        if (chunk) {
+            feed.head = chunk->next;
+            if (!feed.head) feed.tail = NULL;
+        }
+        int at_eof = !feed.head && feed.done;
+        pthread_mutex_unlock(&feed.lock);
+
+        if (chunk) {
+            rc = gzip_buffer_reserve(&ix, &size, produced + chunk->len);
+            if (rc == 0) {
+                memcpy(ix.data + produced, chunk->bytes, chunk->len);
+                produced += chunk->len;
+            }
+            pthread_mutex_lock(&feed.lock);
+            chunk->next = feed.spare;
+            feed.spare = chunk;
+            pthread_mutex_unlock(&feed.lock);
+        }
+        if (rc != 0 || (at_eof && feed.error)) break;
+
+        if (at_eof) ix.data[produced] = '\0';
+        rc = index_lines(&ix, produced, at_eof);
+        if (at_eof) break;
+    }
+    pthread_join(thread, NULL);
+    gzip_chunk_free_list(feed.head);
+    gzip_chunk_free_list(feed.spare);
+    pthread_mutex_destroy(&feed.lock);
+    pthread_cond_destroy(&feed.cond);
+
+    if (rc != 0 || feed.error) {
+        if (feed.error) fprintf(stderr, "Error reading compressed input %s\n", ds->path);
+        free(ix.metadata);
+        free(ix.data);
+        return 1;
+    }
+
+    ds->lineCount = ix.count;
+    ds->metadata = ix.metadata;
+    ds->data = ix.data;
+    ds->bytes = ix.capacity * sizeof(StringMetadata) + size + 1;
+    return 0;
+}
+
+static int has_suffix(const char *str, const char *suffix) {
+    size_t n = strlen(str), m = strlen(suffix);
+    return n >= m && strcmp(str + n - m, suffix) == 0;
+}
+
+// Loaded-dataset cache: inputs stay resident for the lifetime of the flow
+// so files repeated in --input are parsed once. Bounded by --cache_mb with
+// least-recently-used eviction.
+static Dataset g_dataset_cache[MAX_OPERATIONS];
+static int g_dataset_count = 0;
+static size_t g_dataset_bytes = 0;
+static unsigned long g_dataset_clock = 0;
+static const char *g_step_scan = "none";  // line splitter behind the running step's input
+
+// Zero-copy key sources (--zero_copy): metadata/data buffers of loaded
+// inputs that table keys point into directly, so inserts copy nothing. A
+// source lives while a Dataset still holds it or any live key references it;
+// released sources with few live keys are compacted into a tight arena.
+typedef struct {
+    StringMetadata *metadata;
+    char *data;                // NULL once compacted (bytes follow metadata)
+    size_t lineCount;
+    size_t bytes;
+    long long refs;            // live table keys referencing the buffers
+    int held;                  // a Dataset still owns these buffers
+    int in_use;
+} KeySource;
+
+static KeySource g_key_sources[KEY_SOURCE_MAX];
+static int g_step_key_source = 0;  // source id + 1 for the running step, 0 -> copy keys
+
+static void key_source_free_if_unused(int id) {
+    KeySource *ks = &g_key_sources[id];
+    if (!ks->in_use || ks->held || ks->refs > 0) return;
+    free(ks->metadata);
+    free(ks->data);
+    memset(ks, 0, sizeof(*ks));
+}
+
+// Hand the buffers of ds to a key source; returns source id + 1, or 0 when
+// keys of this dataset must be copied (pooled buffers or registry full)
+static int share_dataset(Dataset *ds) {
+    if (ds->source) return ds->source;
+    if (ds->pooled) return 0;
+
+    for (int id = 0; id < KEY_SOURCE_MAX; id++) {
+        KeySource *ks = &g_key_sources[id];
+        if (ks->in_use) continue;
+        ks->metadata = ds->metadata;
+        ks->data = ds->data;
+        ks->lineCount = ds->lineCount;
+        ks->bytes = ds->bytes;
+        ks->refs = 0;
+        ks->held = 1;
+        ks->in_use = 1;
+        ds->source = id + 1;
+        return ds->source;
+    }
+    printf("Zero-copy registry full; copying keys of %s\n", ds->path);
+    return 0;
+}
+
+// Apply per-thread reference deltas gathered during a step
+static void key_sources_apply(const long long *rows, int nthreads) {
+    for (int id = 0; id < KEY_SOURCE_MAX; id++) {
+        if (!g_key_sources[id].in_use) continue;
+        for (int t = 0; t < nthreads; t++) {
+            g_key_sources[id].refs += rows[t * KEY_SOURCE_ROW + id];
+        }
+        key_source_free_if_unused(id);
+    }
+}
+
+// Copy the live keys of a released source into one exact-size block and
+// repoint the table at it, so the rest of the input buffer can be freed
+static int compact_key_source(int id) {
+    KeySource *ks = &g_key_sources[id];
+    size_t count = 0, bytes = 0;
+    for (size_t i = 0; i < g_table_size; i++) {
+        if (g_table[i].source == id + 1) {
+            count++;
+            bytes += g_table[i].key->length + 1;
+        }
+    }
+
+    StringMetadata *block = (StringMetadata *)malloc(count * sizeof(StringMetadata) + bytes);
+    if (!block) {
+        perror("Memory allocation failed for key arena");
+        return 1;
+    }
+    char *cursor = (char *)(block + count);
+    size_t k = 0;
+    for (size_t i = 0; i < g_table_size; i++) {
+        if (g_table[i].source != id + 1) continue;
+        StringMetadata *key = g_table[i].key;
+        memcpy(cursor, key->ptr, key->length + 1);
+        block[k].ptr = cursor;
+        block[k].length = key->length;
+        g_table[i].key = &block[k];
+        cursor += key->length + 1;
+        k++;
+    }
+
+    printf("Compacted zero-copy source: %.1f MB -> %.1f MB (%zu live keys)\n",
+           (double)ks->bytes / (1024.0 * 1024.0),
+           (double)(count * sizeof(StringMetadata) + bytes) / (1024.0 * 1024.0), count);
+    free(ks->metadata);
+    free(ks->data);
+    ks->metadata = block;
+    ks->data = NULL;
+    ks->lineCount = count;
+    ks->bytes = count * sizeof(StringMetadata) + bytes;
+    return 0;
+}
+
+// Between steps: compact released sources that keep mostly dead records
+static int compact_key_sources(void) {
+    for (int id = 0; id < KEY_SOURCE_MAX; id++) {
+        KeySource *ks = &g_key_sources[id];
+        if (!ks->in_use || ks->held || ks->data == NULL) continue;
+        if ((double)ks->refs >= (double)ks->lineCount * KEY_SOURCE_COMPACT) continue;
+        if (compact_key_source(id) != 0) return 1;
+    }
+    return 0;
+}
+
+static void release_key_sources(void) {
+    for (int id = 0; id < KEY_SOURCE_MAX; id++) {
+        g_key_sources[id].held = 0;
+        g_key_sources[id].refs = 0;
+        key_source_free_if_unused(id);
+    }
+}
+
+static void free_dataset(Dataset *ds) {
+    free(ds->path);
+    if (ds->source) {
+        g_key_sources[ds->source - 1].held = 0;
+        key_source_free_if_unused(ds->source - 1);
+    } else if (!ds->pooled) {
+        free(ds->metadata);
+        free(ds->data);
+    }
+    memset(ds, 0, sizeof(*ds));
+}
+
+static void evict_dataset(int index) {
+    g_dataset_bytes -= g_dataset_cache[index].bytes;
+    free_dataset(&g_dataset_cache[index]);
+    g_dataset_cache[index] = g_dataset_cache[--g_dataset_count];
+}
+
+// Parse a file into ds (path and identity already filled in). With the
+// stdio reader, datasets too big for the cache (cap bytes) are read into the
+// buffer pool instead; the chunked and gzip readers always allocate.
+static int load_dataset(Dataset *ds, const char *reader, size_t cap, const char **used) {
+    ds->scan = g_kernels.scan_name;
+    if (has_suffix(ds->path, ".gz")) {
+        *used = "zlib";
+        if (read_dataset_gzip(ds) != 0) return 1;
+        if (ds->lineCount == 0) {
+            free(ds->metadata);
+            free(ds->data);
+            ds->metadata = NULL;
+            ds->data = NULL;
+        }
+        return 0;
+    }
+    if (strcmp(reader, "stdio") != 0) {
+        if (read_dataset_chunked(ds, reader, used) != 0) return 1;
+        if (ds->lineCount == 0) {
+            free(ds->metadata);
+            free(ds->data);
+            ds->metadata = NULL;
+            ds->data = NULL;
+        }
+        return 0;
+    }
+
+    *used = "stdio";
+    ds->scan = "fgets";
+    size_t totalDataSize = 0;
+    if (preprocess(ds->path, &ds->lineCount, &totalDataSize) != 0) return 1;
+    if (ds->lineCount == 0) return 0;
+
+    ds->bytes = ds->lineCount * sizeof(StringMetadata) + totalDataSize + 1;
+    if (ds->bytes > cap) {
+        ds->pooled = 1;
+        ds->metadata = (StringMetadata *)pool_get(POOL_METADATA, ds->lineCount * sizeof(StringMetadata), 0);
+        ds->data = (char *)pool_get(POOL_DATA, totalDataSize + 1, 0);
+        if (!ds->metadata || !ds->data) {
+            perror("Memory allocation failed for data");
+            return 1;
+        }
+    } else if (allocate_memory(ds->lineCount, totalDataSize, &ds->metadata, &ds->data) != 0) {
+        return 1;
+    }
+
+    if (read_data(ds->path, ds->lineCount, ds->metadata, ds->data) != 0) {
+        if (!ds->pooled) {
+            free(ds->metadata);
+            free(ds->data);
+        }
+        ds->metadata = NULL;
+        ds->data = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+// Get the parsed contents of path, from the cache when the file is unchanged.
+// The result stays valid until release_dataset(); transient datasets (cache
+// disabled or over the cap) live in the buffer pool, are returned in *out
+// and are overwritten by the next transient load.
+static Dataset *acquire_dataset(const ProgramArgs *args, const char *path, Dataset *out) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        perror("Error opening file");
+        return NULL;
+    }
+
+    for (int i = 0; i < g_dataset_count; i++) {
+        Dataset *ds = &g_dataset_cache[i];
+        if (strcmp(ds->path, path) != 0) continue;
+        if (ds->dev == st.st_dev && ds->ino == st.st_ino && ds->file_size == st.st_size &&
+            ds->mtime.tv_sec == st.st_mtim.tv_sec && ds->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+            ds->last_used = ++g_dataset_clock;
+            printf("Using cached %s (%zu records)\n", path, ds->lineCount);
+            g_step_scan = ds->scan;
+            return ds;
+        }
+        evict_dataset(i);  // file changed on disk
+        break;
+    }
+
+    Dataset loaded;
+    memset(&loaded, 0, sizeof(loaded));
+    loaded.path = strdup(path);
+    loaded.dev = st.st_dev;
+    loaded.ino = st.st_ino;
+    loaded.mtime = st.st_mtim;
+    loaded.file_size = st.st_size;
+    if (!loaded.path) {
+        perror("Memory allocation failed for dataset");
+        return NULL;
+    }
+
+    size_t cap = args->cache_mb < 0 ? (size_t)-1 : (size_t)args->cache_mb * 1024 * 1024;
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    const char *used = NULL;
+    // Zero-copy keys may outlive the step, so never load into the pool then
+    if (load_dataset(&loaded, args->reader, args->zero_copy ? (size_t)-1 : cap, &used) != 0) {
+        free(loaded.path);
+        return NULL;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = elapsed_seconds(&t0, &t1);
+    printf("Loaded %s (%zu records, %.1f MB) in %.2f ms, read %.1f MB/s via %s\n", path,
+           loaded.lineCount, (double)loaded.bytes / (1024.0 * 1024.0), secs * 1000.0,
+           secs > 0 ? (double)loaded.file_size / secs / 1e6 : 0.0, used);
+
+    g_step_scan = loaded.scan;
+    if (loaded.pooled || loaded.bytes > cap) {
+        *out = loaded;
+        return out;
+    }
+
+    // Evict least recently used datasets until the new one fits
+    while (g_dataset_count > 0 &&
+           (g_dataset_count == MAX_OPERATIONS || g_dataset_bytes + loaded.bytes > cap)) {
+        int lru = 0;
+        for (int i = 1; i < g_dataset_count; i++) {
+            if (g_dataset_cache[i].last_used < g_dataset_cache[lru].last_used) lru = i;
+        }
+        printf("Evicting cached %s\n", g_dataset_cache[lru].path);
+        evict_dataset(lru);
+    }
+
+    Dataset *ds = &g_dataset_cache[g_dataset_count++];
+    *ds = loaded;
+    ds->cached = 1;
+    ds->last_used = ++g_dataset_clock;
+    g_dataset_bytes += ds->bytes;
+    return ds;
+}
+
+static void release_dataset(Dataset *ds) {
+    if (!ds->cached) free_dataset(ds);
+}
+
+static void cleanup_dataset_cache(void) {
+    while (g_dataset_count > 0) evict_dataset(g_dataset_count - 1);
+    g_dataset_bytes = 0;
+}
+
+// One block of a parallel gzip write
+typedef struct {
+    const char *in;
+    size_t in_len;
+    unsigned char *out;
+    size_t out_len;
+    int error;
+} GzipBlock;
+
+typedef struct {
+    GzipBlock *blocks;
+    size_t nblocks;
+    size_t first;              // this thread compresses first, first + stride, ...
+    size_t stride;
+} GzipWorkerArgs;
+
+static void *gzip_deflate_worker(void *arg) {
+    GzipWorkerArgs *ga = (GzipWorkerArgs *)arg;
+
+    for (size_t b = ga->first; b < ga->nblocks; b += ga->stride) {
+        GzipBlock *blk = &ga->blocks[b];
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        if (deflateInit2(&zs, GZIP_LEVEL, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            blk->error = 1;
+            continue;
+        }
+
+        size_t bound = deflateBound(&zs, (uLong)blk->in_len);
+        blk->out = (unsigned char *)malloc(bound);
+        if (!blk->out) {
+            deflateEnd(&zs);
+            blk->error = 1;
+            continue;
+        }
+
+        zs.next_in = (unsigned char *)blk->in;
+        zs.avail_in = (uInt)blk->in_len;
+        zs.next_out = blk->out;
+        zs.avail_out = (uInt)bound;
+        blk->error = (deflate(&zs, Z_FINISH) != Z_STREAM_END);
+        blk->out_len = bound - zs.avail_out;
+        deflateEnd(&zs);
+    }
+    return NULL;
+}
+
+// Write len bytes of text to path as a sequence of independent gzip members,
+// one per GZIP_BLOCK_SIZE block, compressed by up to nthreads threads. The
+// concatenation is a valid multi-member gzip file, including when appended.
+static int write_gzip_members(const char *path, const char *mode, const char *text,
+                              size_t len, int nthreads) {
+    size_t nblocks = (len + GZIP_BLOCK_SIZE - 1) / GZIP_BLOCK_SIZE;
+    if (nblocks == 0) nblocks = 1;
+    if (nthreads < 1) nthreads = 1;
+    if ((size_t)nthreads > nblocks) nthreads = (int)nblocks;
+
+    GzipBlock *blocks = (GzipBlock *)calloc(nblocks, sizeof(GzipBlock));
+    pthread_t *threads = (pthread_t *)malloc(nthreads * sizeof(pthread_t));
+    GzipWorkerArgs *gargs = (GzipWorkerArgs *)malloc(nthreads * sizeof(GzipWorkerArgs));
+    if (!blocks || !threads || !gargs) {
+        perror("Memory allocation failed for compression");
+        free(blocks);
+        free(threads);
+        free(gargs);
+        return 1;
+    }
+
+    for (size_t b = 0; b < nblocks; b++) {
+        blocks[b].in = text + b * GZIP_BLOCK_SIZE;
+        blocks[b].in_len = (b + 1 == nblocks) ? len - b * GZIP_BLOCK_SIZE : GZIP_BLOCK_SIZE;
+    }
+    for (int t = 0; t < nthreads; ++t) {
+        gargs[t] = (GzipWorkerArgs){ .blocks = blocks, .nblocks = nblocks, .first = (size_t)t, .stride = (size_t)nthreads };
+        spawn_thread(&threads[t], gzip_deflate_worker, &gargs[t]);
+    }
+    for (int t = 0; t < nthreads; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+
+    int rc = 0;
+    FILE *out = fopen(path, mode);
+    if (!out) {
+        perror("Cannot open results file");
+        rc = 1;
+    }
+    for (size_t b = 0; b < nblocks; b++) {
+        if (blocks[b].error) {
+            fprintf(stderr, "Compression of results block %zu failed\n", b);
+            rc = 1;
+        } else if (out && rc == 0 && fwrite(blocks[b].out, 1, blocks[b].out_len, out) != blocks[b].out_len) {
+            perror("Cannot write results file");
+            rc = 1;
+        }
+        free(blocks[b].out);
+    }
+    if (out && fclose(out) != 0 && rc == 0) {
+        perror("Cannot write results file");
+        rc = 1;
+    }
+
+    free(blocks);
+    free(threads);
+    free(gargs);
+    return rc;
+}
+
+// Results file of this flow (without the .gz suffix)
+static void results_path(const ProgramArgs *args, char *outfile, size_t size) {
+    // Build flow string for filename
+    char flow[256] = "";
+    for (int j = 0; j < args->num_operations; ++j) {
+        strcat(flow, args->action[j]);
+        if (j + 1 < args->num_operations) strcat(flow, "_");
+    }
+
+    char data_size_str[32], tsize_str[32];
+    deparse_size(args->data_size, data_size_str, sizeof(data_size_str));
+    deparse_size(args->tsize, tsize_str, sizeof(tsize_str));
+    snprintf(outfile, size,
+             "%s/Results_HW2_MCC_030402_401106039_%s_%d_%s_%s.txt%s",
+             args->results_dir, data_size_str, args->threads, tsize_str, flow, args->compress_results ? ".gz" : "");
+}
+
+static void write_results_header(FILE *out, const char *action, long long elapsed_ms, size_t total_collisions) {
+    fprintf(out, "Actions: %s\n", action);
+    fprintf(out, "ExecutionTime: %lld ms\n", elapsed_ms);
+    fprintf(out, "NumberOfHandledCollision: %zu\n", total_collisions);
+    fprintf(out, "Kernels: isa=%s hash=fnv1a64 scan=%s keyeq=memcmp\n", g_kernels.isa, g_step_scan);
+}
+
+// Helper function to write operation results to file; nonzero if the file
+// could not be written completely
+static int write_operation_results(const ProgramArgs *args, int op_index, const char *action,
+                                   size_t lineCount, StringMetadata *metadata, 
+                                   size_t *indices, char *results, 
+                                   long long elapsed_ms, size_t total_collisions) {
+    // Write results to file
+    char outfile[512];
+    results_path(args, outfile, sizeof(outfile));
+
+    // Compressed output is formatted in memory, then gzipped in parallel
+    char *text = NULL;
+    size_t text_len = 0;
+    FILE *out = args->compress_results ? open_memstream(&text, &text_len)
+                                       : fopen(outfile, (op_index == 0) ? "w" : "a");
+    if (!out) {
+        perror("Cannot open results file");
+        return 1;
+    }
+
+    write_results_header(out, action, elapsed_ms, total_collisions);
+
+    if (strcmp(action, "insert") == 0) {
+        for (size_t j = 0; j < lineCount; ++j) {
+            fprintf(out, "%s:%zu:%c", metadata[j].ptr, indices[j], results[j]);
+            if (j + 1 < lineCount) fprintf(out, ", ");
+        }
+    } else if (strcmp(action, "delete") == 0 || strcmp(action, "lookup") == 0) {
+        // For delete and lookup: keys found as Data:index:T, others as Data:F
+        int first = 1;
+        for (size_t j = 0; j < lineCount; ++j) {
+            if (results[j] == 'T') { // Successfully deleted
+                if (!first) fprintf(out, ", ");
+                fprintf(out, "%s:%zu:%c", metadata[j].ptr, indices[j], results[j]);
+                first = 0;
+            } else {
+                // Failed deletion: only output Data:F
+                if (!first) fprintf(out, ", ");
+                fprintf(out, "%s:%c", metadata[j].ptr, results[j]);
+                first = 0;
+            }
+        }
+    }
+
+    fprintf(out, "\n");
+    int rc = 0;
+    if (fclose(out) != 0) {
+        perror("Cannot write results file");
+        rc = 1;
+    }
+
+    if (args->compress_results) {
+        if (rc == 0) rc = write_gzip_members(outfile, (op_index == 0) ? "w" : "a", text, text_len, args->threads);
+        free(text);
+    }
+    return rc;
+}
+
+// ------------------------------------------------------------------------
+// Machine calibration (--calibrate): before the flow, measure sequential
+// read bandwidth, dependent-load latency over a buffer the size of the
+// table's footprint, and the random-access throughput reached with 1, 2, 4
+// ... --threads threads each running CALIBRATE_CHAINS independent chases.
+// After each step the achieved random accesses/s (one per key plus one per
+// handled collision) is reported as a fraction of the best throughput, so a
+// step near 100% is memory-bound rather than limited by the engine.
+
+typedef struct {
+    int valid;
+    size_t footprint;           // bytes chased
+    double seq_gbps;
+    double latency_ns;
+    double ceiling;             // best random accesses/s
+    int ceiling_threads;
+} Calibration;
+
+static Calibration g_calibration;
+
+typedef struct {
+    const uint64_t *words;
+    size_t count;
+    const uint32_t *next;       // chase: node i continues at next[i * stride]
+    size_t stride;              // uint32 per node
+    size_t nodes;
+    size_t steps;               // loads per chain
+    int chains;                 // independent chains, at most CALIBRATE_CHAINS
+    uint32_t start;
+    uint64_t result;
+} CalibrateArgs;
+
+static void *calibrate_stream_worker(void *arg) {
+    CalibrateArgs *ca = (CalibrateArgs *)arg;
+    uint64_t sum = 0;
+    for (int pass = 0; pass < CALIBRATE_SEQ_PASSES; pass++) {
+        for (size_t i = 0; i < ca->count; i++) sum += ca->words[i];
+    }
+    ca->result = sum;
+    return NULL;
+}
+
+static void *calibrate_chase_worker(void *arg) {
+    CalibrateArgs *ca = (CalibrateArgs *)arg;
+    uint32_t pos[CALIBRATE_CHAINS];
+    for (int c = 0; c < ca->chains; c++) {
+        pos[c] = (uint32_t)((ca->start + (size_t)c * (ca->nodes / CALIBRATE_CHAINS)) % ca->nodes);
+    }
+    for (size_t s = 0; s < ca->steps; s++) {
+        for (int c = 0; c < ca->chains; c++) pos[c] = ca->next[(size_t)pos[c] * ca->stride];
+    }
+    uint64_t sum = 0;
+    for (int c = 0; c < ca->chains; c++) sum += pos[c];
+    ca->result = sum;
+    return NULL;
+}
+
+// Run nthreads copies of fn over args and return the wall time in seconds
+static double calibrate_run(void *(*fn)(void *), CalibrateArgs *cargs, int nthreads) {
+    pthread_t threads[CALIBRATE_MAX_THREADS];
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int t = 0; t < nthreads; t++) spawn_thread(&threads[t], fn, &cargs[t]);
+    for (int t = 0; t < nthreads; t++) pthread_join(threads[t], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return elapsed_seconds(&t0, &t1);
+}
+
+static int calibrate_machine(const ProgramArgs *args) {
+    int max_threads = args->threads;
+    if (max_threads < 1) max_threads = 1;
+    if (max_threads > CALIBRATE_MAX_THREADS) max_threads = CALIBRATE_MAX_THREADS;
+    CalibrateArgs cargs[CALIBRATE_MAX_THREADS];
+
+    // Sequential bandwidth over disjoint slices
+    uint64_t *words = (uint64_t *)malloc(CALIBRATE_SEQ_BYTES);
+    if (!words) {
+        perror("Memory allocation failed for calibration");
+        return 1;
+    }
+    size_t count = CALIBRATE_SEQ_BYTES / sizeof(uint64_t);
+    for (size_t i = 0; i < count; i++) words[i] = i;
+    for (int t = 0; t < max_threads; t++) {
+        size_t lo = count * t / max_threads, hi = count * (t + 1) / max_threads;
+        cargs[t] = (CalibrateArgs){ .words = words + lo, .count = hi - lo };
+    }
+    double secs = calibrate_run(calibrate_stream_worker, cargs, max_threads);
+    g_calibration.seq_gbps = (double)CALIBRATE_SEQ_BYTES * CALIBRATE_SEQ_PASSES / secs / 1e9;
+    free(words);
+
+    // Table footprint: every slot plus the key allocations of a full data set
+    size_t footprint = args->tsize * sizeof(HashEntry) +
+                       args->data_size * (sizeof(StringMetadata) + CALIBRATE_KEY_BYTES);
+    if (footprint < CALIBRATE_MIN_FOOTPRINT) footprint = CALIBRATE_MIN_FOOTPRINT;
+    size_t nodes = footprint / CALIBRATE_LINE;
+    size_t stride = CALIBRATE_LINE / sizeof(uint32_t);
+    uint32_t *next = (uint32_t *)malloc(nodes * CALIBRATE_LINE);
+    uint32_t *order = (uint32_t *)malloc(nodes * sizeof(uint32_t));
+    if (!next || !order) {
+        perror("Memory allocation failed for calibration");
+        free(next);
+        free(order);
+        return 1;
+    }
+
+    // One random cycle through all nodes (Sattolo), so chases never short-cut
+    uint64_t rng = 0x853c49e6748fea9bULL;
+    for (size_t i = 0; i < nodes; i++) order[i] = (uint32_t)i;
+    for (size_t i = nodes - 1; i > 0; i--) {
+        rng = rng * 6364136223846793005ULL + 1442695040888963407ULL;
+        size_t j = (size_t)((rng >> 33) % i);
+        uint32_t tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+    for (size_t i = 0; i < nodes; i++) next[(size_t)order[i] * stride] = order[(i + 1) % nodes];
+    free(order);
+
+    // Latency: one thread, one dependent chain
+    size_t steps = CALIBRATE_CHASE_STEPS / CALIBRATE_CHAINS;
+    cargs[0] = (CalibrateArgs){ .next = next, .stride = stride, .nodes = nodes,
+                                .steps = steps, .chains = 1, .start = 0 };
+    secs = calibrate_run(calibrate_chase_worker, cargs, 1);
+    g_calibration.latency_ns = secs * 1e9 / (double)steps;
+
+    // Throughput scaling: the same total work split over 1, 2, 4 ... threads
+    printf("Calibration: random-access throughput over %.1f MB:", (double)footprint / (1024.0 * 1024.0));
+    g_calibration.ceiling = 0.0;
+    for (int t = 1; t <= max_threads; t = (t * 2 > max_threads && t < max_threads) ? max_threads : t * 2) {
+        size_t per_thread = CALIBRATE_CHASE_STEPS / CALIBRATE_CHAINS / (size_t)t + 1;
+        for (int k = 0; k < t; k++) {
+            cargs[k] = (CalibrateArgs){ .next = next, .stride = stride, .nodes = nodes,
+                                        .steps = per_thread, .chains = CALIBRATE_CHAINS,
+                                        .start = (uint32_t)(nodes * k / t) };
+        }
+        secs = calibrate_run(calibrate_chase_worker, cargs, t);
+        double rate = (double)(per_thread * CALIBRATE_CHAINS * t) / secs;
+        printf(" %d:%.1fM/s", t, rate / 1e6);
+        if (rate > g_calibration.ceiling) {
+            g_calibration.ceiling = rate;
+            g_calibration.ceiling_threads = t;
+        }
+    }
+    printf("\n");
+    free(next);
+
+    g_calibration.footprint = footprint;
+    g_calibration.valid = 1;
+    printf("Calibration: sequential read %.2f GB/s, dependent-load latency %.1f ns, "
+           "random-access ceiling %.1f M/s at %d threads\n",
+           g_calibration.seq_gbps, g_calibration.latency_ns,
+           g_calibration.ceiling / 1e6, g_calibration.ceiling_threads);
+    return 0;
+}
+
+// Rate one step against the calibrated ceiling
+static void calibration_report_step(const char *action, size_t keys, size_t collisions, double secs) {
+    if (!g_calibration.valid || secs <= 0.0) return;
+    double accesses = (double)(keys + collisions);
+    double rate = accesses / secs;
+    printf("Roofline: %s %.0f accesses in %.2f ms = %.1f M/s, %.0f%% of random-access ceiling\n",
+           action, accesses, secs * 1000.0, rate / 1e6, 100.0 * rate / g_calibration.ceiling);
+}
+
+// Thread body replacing g_engine->worker for one step (frozen-index lookups)
+static void *(*g_step_worker)(void *) = NULL;
+
+// Run one flow step on the current engine: split the lines across worker
+// threads, time them and collect per-line indices/results and collisions.
+static int run_hash_step(const ProgramArgs *args, int op_index, const char *action,
+                         size_t lineCount, StringMetadata *metadata,
+                         size_t *indices, char *results,
+                         long long *elapsed_ms, size_t *total_collisions) {
+    // Setup threading
+    int nthreads = args->threads;
+    if (nthreads < 1) nthreads = 1;
+    if ((size_t)nthreads > lineCount) nthreads = (int)lineCount;
+
+    pthread_t *threads = (pthread_t *)pool_get(POOL_THREADS, nthreads * sizeof(pthread_t), 0);
+    WorkerArgs *wargs = (WorkerArgs *)pool_get(POOL_WARGS, nthreads * sizeof(WorkerArgs), 0);
+    size_t *thread_collisions = (size_t *)pool_get(POOL_COLLISIONS, nthreads * sizeof(size_t), 1);
+    ThreadProgress *progress = (ThreadProgress *)pool_get(POOL_PROGRESS, nthreads * sizeof(ThreadProgress), 1);
+    long long *source_refs = (long long *)pool_get(POOL_SOURCE_REFS,
+                                                   nthreads * KEY_SOURCE_ROW * sizeof(long long), 1);
+
+    if (!threads || !wargs || !thread_collisions || !progress || !source_refs) {
+        perror("Thread allocation failed");
+        return 1;
+    }
+
+    size_t chunk = (lineCount + nthreads - 1) / nthreads;
+
+    void *(*step_worker)(void *) = g_step_worker ? g_step_worker : g_engine->worker;
+    if (!g_step_worker && g_engine->begin_step && g_engine->begin_step(action, nthreads) != 0) {
+        return 1;
+    }
+
+    ProgressReporter reporter;
+    progress_start(&reporter, args, op_index, action, lineCount, progress, nthreads);
+
+    // Start timing
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    // Create and start worker threads
+    for (int t = 0; t < nthreads; ++t) {
+        size_t start = t * chunk;
+        if (start > lineCount) start = lineCount;  // trailing threads get empty ranges
+        size_t end = start + chunk;
+        if (end > lineCount) end = lineCount;
+
+        wargs[t] = (WorkerArgs){
+            .start = start,
+            .end = end,
+            .meta = metadata,
+            .out_indices = indices,
+            .out_results = results,
+            .collision_count = &thread_collisions[t],
+            .progress = &progress[t],
+            .action = action,
+            .thread_id = t,
+            .nthreads = nthreads,
+            .key_source = g_step_key_source,
+            .source_refs = &source_refs[t * KEY_SOURCE_ROW]
+        };
+        spawn_thread(&threads[t], step_worker, &wargs[t]);
+    }
+
+    // Wait for all threads to complete
+    for (int t = 0; t < nthreads; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+
+    // End timing
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    *elapsed_ms = (t1.tv_sec - t0.tv_sec) * 1000LL + (t1.tv_nsec - t0.tv_nsec) / 1000000LL;
+
+    progress_stop(&reporter);
+
+    // Sum up collision counts
+    *total_collisions = 0;
+    long long live_delta = 0;
+    for (int t = 0; t < nthreads; ++t) {
+        *total_collisions += thread_collisions[t];
+        live_delta += atomic_load_explicit(&progress[t].live_delta, memory_order_relaxed);
+    }
+    g_live_keys = (size_t)((long long)g_live_keys + live_delta);
+    key_sources_apply(source_refs, nthreads);
+    if (!g_step_worker && g_engine->end_step) g_engine->end_step();
+
+    return 0;
+}
+
+// Helper function to execute hash operation (insert, delete or lookup)
+static int execute_hash_operation(const ProgramArgs *args, int op_index, const char *action,
+                                 size_t lineCount, StringMetadata *metadata) {
+    printf("%s %zu records...\n", (strcmp(action, "insert") == 0) ? "Inserting" :
+           (strcmp(action, "delete") == 0) ? "Deleting" : "Looking up", lineCount);
+
+    // Ensure hash table and locks are initialized
+    if (g_engine->ensure(args->tsize) != 0) {
+        return 1;
+    }
+
+    // Arrays for results, reused across steps
+    size_t *indices = (size_t *)pool_get(POOL_INDICES, lineCount * sizeof(size_t), 0);
+    char *results = (char *)pool_get(POOL_RESULTS, lineCount * sizeof(char), 0);
+    if (!indices || !results) {
+        perror("Memory allocation failed for results");
+        return 1;
+    }
+
+    long long elapsed_ms = 0;
+    size_t total_collisions = 0;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (run_hash_step(args, op_index, action, lineCount, metadata,
+                      indices, results, &elapsed_ms, &total_collisions) != 0) {
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    calibration_report_step(action, lineCount, total_collisions, elapsed_seconds(&t0, &t1));
+
+    // Write results to file
+    return write_operation_results(args, op_index, action, lineCount, metadata,
+                                   indices, results, elapsed_ms, total_collisions);
+}
+
+// Rebuild the table to new_size between steps and report the change
+static int resize_table(const ProgramArgs *args, size_t new_size, const char *why) {
+    size_t old_size = g_engine->capacity();
+    // Same bounds as the engines' resize: nothing to rebuild, or too small for the live keys
+    if (old_size == 0 || new_size == old_size || new_size <= g_live_keys) return 0;
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (g_engine->resize(new_size, args->threads) != 0) return 1;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    printf("%s table: %zu -> %zu slots (%zu live keys, load %.3f -> %.3f), rebuild %.2f ms\n",
+           why, old_size, new_size, g_live_keys,
+           (double)g_live_keys / (double)old_size, (double)g_live_keys / (double)new_size,
+           elapsed_seconds(&t0, &t1) * 1000.0);
+    return 0;
+}
+
+// Shrink policy, checked after delete steps (see RESIZE_GROW_LOAD)
+static int maybe_shrink_table(const ProgramArgs *args) {
+    size_t size = g_engine->capacity();
+    if (args->shrink_below <= 0.0 || !g_engine->resize || size == 0) return 0;
+    if ((double)g_live_keys >= args->shrink_below * (double)size) return 0;
+
+    size_t new_size = (size_t)((double)g_live_keys / (2 * args->shrink_below)) + 1;
+    if (new_size < RESIZE_MIN_SLOTS) new_size = RESIZE_MIN_SLOTS;
+    if (new_size * 2 > size) return 0;  // not worth a rebuild
+
+    return resize_table(args, new_size, "Shrinking");
+}
+
+// Before an insert step, grow a previously shrunk table back so the step
+// cannot fill it (up to the user's --tsize)
+static int maybe_grow_table(const ProgramArgs *args, size_t lineCount) {
+    size_t size = g_engine->capacity();
+    if (args->shrink_below <= 0.0 || !g_engine->resize || size == 0 || size >= args->tsize) return 0;
+
+    size_t worst_case = g_live_keys + lineCount;
+    if ((double)worst_case <= RESIZE_GROW_LOAD * (double)size) return 0;
+
+    size_t new_size = (size_t)((double)worst_case / (2 * args->shrink_below)) + 1;
+    if (new_size > args->tsize) new_size = args->tsize;
+
+    return resize_table(args, new_size, "Growing");
+}
+
+// Clustering report for the linear-probing table, to tell hash quality
+// apart from primary clustering. A cluster is a maximal run of non-empty
+// slots (keys or tombstones, both extend probes). Expected probe counts are
+// Knuth's for linear probing at the effective load a (keys + tombstones):
+// successful (1 + 1/(1-a)) / 2, unsuccessful (1 + 1/(1-a)^2) / 2.
+static int analyze_table(const char *action, int op_index) {
+    size_t n = g_table_size;
+    if (!g_table || n == 0) return 0;
+
+    size_t live = 0, tombstones = 0;
+    double probe_sum = 0.0;
+    size_t region_live[ANALYZE_REGIONS] = {0};
+    for (size_t i = 0; i < n; i++) {
+        if (g_table[i].key) {
+            live++;
+            region_live[i * ANALYZE_REGIONS / n]++;
+            size_t home = fnv1a64(g_table[i].key->ptr, g_table[i].key->length) % n;
+            probe_sum += (double)((i + n - home) % n) + 1.0;
+        } else if (g_table[i].tombstone) {
+            tombstones++;
+        }
+    }
+
+    // Walk clusters starting just after an empty slot so none wraps twice
+    size_t clusters = 0, longest = 0, empty = live + tombstones < n ? n - live - tombstones : 0;
+    size_t classes[ANALYZE_CLUSTER_CLASSES] = {0};
+    double unsuccessful_sum = (double)empty;
+    size_t first = 0;
+    while (first < n && (g_table[first].key || g_table[first].tombstone)) first++;
+    size_t run = 0;
+    for (size_t k = 1; k <= n; k++) {
+        size_t i = (first + k) % n;
+        if (empty > 0 && !g_table[i].key && !g_table[i].tombstone) {
+            if (run > 0) {
+                int c = 0;
+                while (c + 1 < ANALYZE_CLUSTER_CLASSES && ((size_t)1 << c) < run) c++;
+                classes[c]++;
+                clusters++;
+                if (run > longest) longest = run;
+                unsuccessful_sum += (double)run * (double)(run + 1) / 2.0 + (double)run;
+            }
+            run = 0;
+        } else {
+            run++;
+        }
+    }
+    if (empty == 0) {
+        clusters = 1;
+        longest = n;
+    }
+
+    // Chi-squared of home slots over equal-width bins
+    size_t bins = live / ANALYZE_MIN_EXPECTED;
+    if (bins > ANALYZE_MAX_BINS) bins = ANALYZE_MAX_BINS;
+    if (bins > n) bins = n;
+    double chi2 = 0.0;
+    if (bins >= 2) {
+        size_t *observed = (size_t *)calloc(bins, sizeof(size_t));
+        if (!observed) {
+            perror("Memory allocation failed for analysis");
+            return 1;
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (!g_table[i].key) continue;
+            size_t home = fnv1a64(g_table[i].key->ptr, g_table[i].key->length) % n;
+            observed[(size_t)((unsigned __int128)home * bins / n)]++;
+        }
+        for (size_t b = 0; b < bins; b++) {
+            // Bin b covers slots [b*n/bins, (b+1)*n/bins)
+            size_t lo = (size_t)((unsigned __int128)b * n / bins);
+            size_t hi = (size_t)((unsigned __int128)(b + 1) * n / bins);
+            double expected = (double)live * (double)(hi - lo) / (double)n;
+            double d = (double)observed[b] - expected;
+            chi2 += d * d / expected;
+        }
+        free(observed);
+    }
+
+    double load = (double)live / (double)n;
+    double alpha = (double)(live + tombstones) / (double)n;
+    printf("Analysis after %s (step %d): %zu slots, %zu live, %zu tombstones, load %.3f (%.3f with tombstones)\n",
+           action, op_index + 1, n, live, tombstones, load, alpha);
+
+    printf("  Clusters: %zu, mean length %.2f, longest %zu\n", clusters,
+           clusters ? (double)(live + tombstones) / (double)clusters : 0.0, longest);
+    printf("   ");
+    for (int c = 0; c < ANALYZE_CLUSTER_CLASSES; c++) {
+        if (!classes[c]) continue;
+        size_t lo = c == 0 ? 1 : ((size_t)1 << (c - 1)) + 1, hi = (size_t)1 << c;
+        if (lo == hi) printf(" %zu: %zu", lo, classes[c]);
+        else printf(" %zu-%zu: %zu", lo, hi, classes[c]);
+    }
+    printf("\n");
+
+    double rmin = 1.0, rmax = 0.0;
+    printf("  Region occupancy (%d):", ANALYZE_REGIONS);
+    for (int r = 0; r < ANALYZE_REGIONS; r++) {
+        size_t lo = r * n / ANALYZE_REGIONS, hi = (r + 1) * n / ANALYZE_REGIONS;
+        double occ = hi > lo ? (double)region_live[r] / (double)(hi - lo) : 0.0;
+        if (occ < rmin) rmin = occ;
+        if (occ > rmax) rmax = occ;
+        printf(" %.0f%%", occ * 100.0);
+    }
+    printf(" (min %.1f%%, max %.1f%%)\n", rmin * 100.0, rmax * 100.0);
+
+    if (bins >= 2) {
+        double df = (double)(bins - 1);
+        printf("  Home slots chi-squared: %.1f over %.0f df (z = %.2f; |z| > 3 suggests a biased hash)\n",
+               chi2, df, (chi2 - df) / sqrt(2.0 * df));
+    }
+
+    if (alpha < 1.0) {
+        double q = 1.0 / (1.0 - alpha);
+        printf("  Probes per search: successful %.2f observed / %.2f expected, "
+               "unsuccessful %.2f observed / %.2f expected\n",
+               live ? probe_sum / (double)live : 0.0, 0.5 * (1.0 + q),
+               unsuccessful_sum / (double)n, 0.5 * (1.0 + q * q));
+    } else {
+        printf("  Probes per search: table full, unsuccessful searches do not terminate early\n");
+    }
+    return 0;
+}
+
+// splitmix64 finalizer; spreads FNV-1a output evenly over all 64 bits
+static inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// Arguments for one HyperLogLog thread
+typedef struct {
+    size_t start;             // inclusive
+    size_t end;               // exclusive
+    const StringMetadata *meta;
+    uint8_t *registers;       // HLL_REGISTERS private registers
+} HllArgs;
+
+static void *hll_worker(void *arg) {
+    HllArgs *ha = (HllArgs *)arg;
+
+    for (size_t i = ha->start; i < ha->end; i++) {
+        uint64_t h = mix64(fnv1a64(ha->meta[i].ptr, ha->meta[i].length));
+        size_t reg = (size_t)(h >> (64 - HLL_PRECISION));
+        uint64_t rest = h << HLL_PRECISION;
+        uint8_t rank = rest ? (uint8_t)(__builtin_clzll(rest) + 1) : (uint8_t)(64 - HLL_PRECISION + 1);
+        if (rank > ha->registers[reg]) ha->registers[reg] = rank;
+    }
+    return NULL;
+}
+
+// Estimate the number of distinct keys in metadata. Threads fill private
+// registers which are merged by max; returns 0 on allocation failure.
+static double hll_estimate_distinct(const StringMetadata *metadata, size_t lineCount, int nthreads) {
+    if (nthreads < 1) nthreads = 1;
+    if ((size_t)nthreads > lineCount) nthreads = (int)lineCount;
+    if (nthreads == 0) return 0.0;
+
+    uint8_t *registers = (uint8_t *)calloc((size_t)nthreads, HLL_REGISTERS);
+    pthread_t *threads = (pthread_t *)malloc(nthreads * sizeof(pthread_t));
+    HllArgs *hargs = (HllArgs *)malloc(nthreads * sizeof(HllArgs));
+    if (!registers || !threads || !hargs) {
+        perror("HyperLogLog allocation failed");
+        free(registers);
+        free(threads);
+        free(hargs);
+        return 0.0;
+    }
+
+    size_t chunk = (lineCount + nthreads - 1) / nthreads;
+    for (int t = 0; t < nthreads; ++t) {
+        size_t start = t * chunk;
+        size_t end = start + chunk;
+        if (start > lineCount) start = lineCount;
+        if (end > lineCount) end = lineCount;
+
+        hargs[t] = (HllArgs){
+            .start = start,
+            .end = end,
+            .meta = metadata,
+            .registers = registers + (size_t)t * HLL_REGISTERS
+        };
+        spawn_thread(&threads[t], hll_worker, &hargs[t]);
+    }
+    for (int t = 0; t < nthreads; ++t) {
+        pthread_join(threads[t], NULL);
+    }
+
+    // Merge into thread 0's registers and apply the standard estimator
+    double sum = 0.0;
+    size_t zeros = 0;
+    for (size_t r = 0; r < HLL_REGISTERS; r++) {
+        uint8_t max = registers[r];
+        for (int t = 1; t < nthreads; ++t) {
+            if (registers[(size_t)t * HLL_REGISTERS + r] > max) max = registers[(size_t)t * HLL_REGISTERS + r];
+        }
+        sum += 1.0 / (double)(1ULL << max);
+        if (max == 0) zeros++;
+    }
+
+    double m = (double)HLL_REGISTERS;
+    double estimate = (0.7213 / (1.0 + 1.079 / m)) * m * m / sum;
+    if (estimate <= 2.5 * m && zeros > 0) {
+        estimate = m * log((double)HLL_REGISTERS / (double)zeros);  // linear counting
+    }
+
+    free(registers);
+    free(threads);
+    free(hargs);
+    return estimate;
+}
+
+// --presize: before an insert step, create (or grow) the table so the
+// expected live keys sit at --target_load. "data_size" trusts --data_size
+// for the whole flow; "hll" adds this step's estimated distinct keys to the
+// live count, so it also grows the table ahead of later insert steps.
+static int presize_table(const ProgramArgs *args, size_t lineCount, const StringMetadata *metadata) {
+    if (!args->presize) return 0;
+
+    size_t size = g_engine->capacity();
+    double expected;
+    double elapsed_ms = 0.0;
+
+    if (strcmp(args->presize, "data_size") == 0) {
+        if (size != 0) return 0;
+        expected = (double)args->data_size;
+    } else {
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        double distinct = hll_estimate_distinct(metadata, lineCount, args->threads);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        elapsed_ms = elapsed_seconds(&t0, &t1) * 1000.0;
+        if (distinct <= 0.0) return 1;
+
+        // Pad by three standard errors so the estimate is an upper bound in practice
+        distinct *= 1.0 + 3.0 * 1.04 / sqrt((double)HLL_REGISTERS);
+        if (distinct > (double)lineCount) distinct = (double)lineCount;
+        expected = (double)g_live_keys + distinct;
+    }
+
+    size_t wanted = (size_t)(expected / args->target_load) + 1;
+    if (wanted < RESIZE_MIN_SLOTS) wanted = RESIZE_MIN_SLOTS;
+
+    if (size == 0) {
+        printf("Presizing table: %zu slots for ~%.0f keys at load %.2f (%s, %.2f ms)\n",
+               wanted, expected, args->target_load, args->presize, elapsed_ms);
+        return g_engine->ensure(wanted) != 0;
+    }
+    if ((double)size * args->target_load >= expected || !g_engine->resize) return 0;
+
+    printf("Presize estimate: ~%.0f keys after this step (%s, %.2f ms)\n",
+           expected, args->presize, elapsed_ms);
+    return resize_table(args, wanted, "Growing");
+}
+
+// ------------------------------------------------------------------------
+// Frozen index (freeze / lookup actions). freeze snapshots the live keys of
+// the engine into a read-only minimal perfect hash built PTHash-style. Keys
+// are split into partitions of ~FREEZE_PARTITION_KEYS that are built in
+// parallel. Inside a partition every key hashes to a bucket (skewed: 60% of
+// the keys go to 30% of the buckets, so the big buckets are placed while the
+// table is still empty) and buckets, largest first, search a 16-bit pilot
+// that sends all their keys to free positions among n / FREEZE_ALPHA. The
+// positions past n are remapped onto the free ones below n, so the n keys
+// land on 0..n-1 where they are packed contiguously. A lookup hashes once,
+// reads one pilot and compares against exactly one key; there is no probing.
+// Any later insert or delete drops the index.
+
+typedef struct {
+    size_t offset;            // global position of local position 0
+    size_t keys;              // n
+    size_t slots;             // m >= n, positions the pilots hash into
+    size_t buckets;
+    size_t skew_buckets;      // buckets that receive FREEZE_SKEW of the keys
+    uint64_t seed;
+    uint16_t *pilots;
+    uint32_t *remap;          // slots - keys entries: position >= n -> free position < n
+    size_t bytes;             // packed key bytes of this partition
+    size_t byte_base;         // offset of the partition in FrozenIndex.bytes
+} MphPartition;
+
+typedef struct {
+    int valid;
+    size_t count;
+    size_t num_partitions;
+    MphPartition *parts;
+    char *bytes;              // keys in position order, NUL terminated
+    size_t *offsets;          // count + 1 offsets into bytes
+    size_t *slots;            // engine slot reported for each position
+} FrozenIndex;
+
+typedef struct {
+    const char *ptr;
+    size_t length;
+    size_t slot;
+    uint64_t hash;
+} FreezeKey;
+
+// Collected keys while enumerating the engine
+typedef struct {
+    FreezeKey *keys;
+    size_t count;
+    size_t cap;
+    int failed;
+} FreezeCollect;
+
+// Shared by the freeze threads; partitions are claimed from next
+typedef struct {
+    int phase;                // 1: place keys, 2: pack them
+    FreezeKey *keys;          // grouped by partition
+    size_t *part_start;       // num_partitions + 1 offsets into keys
+    uint32_t *local;          // per key: position inside its partition
+    atomic_size_t next;
+    atomic_int failed;
+} FreezeShared;
+
+static FrozenIndex g_frozen;
+static uint64_t g_pilot_hash[FREEZE_PILOTS];
+
+static inline size_t mph_partition(uint64_t h, size_t parts) {
+    return (size_t)(((unsigned __int128)mix64(h ^ 0x9e3779b97f4a7c15ULL) * parts) >> 64);
+}
+
+static inline size_t mph_bucket(const MphPartition *p, uint64_t h1) {
+    uint64_t lo = (uint32_t)h1;
+    if ((h1 >> 32) < (uint64_t)(FREEZE_SKEW * 4294967296.0)) return (size_t)((lo * p->skew_buckets) >> 32);
+    return p->skew_buckets + (size_t)((lo * (p->buckets - p->skew_buckets)) >> 32);
+}
+
+// Position of a key inside its partition, before remapping
+static inline size_t mph_slot(const MphPartition *p, uint64_t h2, uint16_t pilot) {
+    return (size_t)((h2 ^ g_pilot_hash[pilot]) % p->slots);
+}
+
+static inline uint64_t mph_h2(const MphPartition *p, uint64_t h) {
+    return mix64(h + p->seed * 0xc2b2ae3d27d4eb4fULL);
+}
+
+static void frozen_release(void) {
+    if (g_frozen.parts) {
+        for (size_t i = 0; i < g_frozen.num_partitions; i++) {
+            free(g_frozen.parts[i].pilots);
+            free(g_frozen.parts[i].remap);
+        }
+    }
+    free(g_frozen.parts);
+    free(g_frozen.bytes);
+    free(g_frozen.offsets);
+    free(g_frozen.slots);
+    memset(&g_frozen, 0, sizeof(g_frozen));
+}
+
+static void freeze_collect(const char *key, size_t length, size_t slot, void *ctx) {
+    FreezeCollect *c = (FreezeCollect *)ctx;
+    if (c->failed) return;
+    if (c->count == c->cap) {
+        size_t cap = c->cap ? c->cap * 2 : 4096;
+        FreezeKey *keys = (FreezeKey *)realloc(c->keys, cap * sizeof(FreezeKey));
+        if (!keys) {
+            c->failed = 1;
+            return;
+        }
+        c->keys = keys;
+        c->cap = cap;
+    }
+    c->keys[c->count++] = (FreezeKey){ key, length, slot, fnv1a64(key, length) };
+}
+
+// Place the keys of one partition: pick a seed, then a pilot per bucket so
+// every key gets its own position. Writes local[] and the partition tables.
+static int mph_build_partition(MphPartition *p, size_t index, const FreezeKey *keys, uint32_t *local) {
+    size_t n = p->keys;
+    if (n == 0) return 0;
+
+    double lg = log2((double)n);
+    if (lg < 1.0) lg = 1.0;
+    p->slots = (size_t)ceil((double)n / FREEZE_ALPHA);
+    p->buckets = (size_t)ceil(FREEZE_BUCKET_C * (double)n / lg);
+    if (p->buckets < 2) p->buckets = 2;
+    p->skew_buckets = (size_t)(FREEZE_SKEW_BUCKETS * (double)p->buckets);
+    if (p->skew_buckets < 1) p->skew_buckets = 1;
+
+    size_t words = (p->slots + 63) / 64;
+    p->pilots = (uint16_t *)calloc(p->buckets, sizeof(uint16_t));
+    p->remap = (uint32_t *)calloc(p->slots - n + 1, sizeof(uint32_t));
+    uint64_t *h2s = (uint64_t *)malloc(n * sizeof(uint64_t));
+    uint32_t *bucket_of = (uint32_t *)malloc(n * sizeof(uint32_t));
+    uint32_t *members = (uint32_t *)malloc(n * sizeof(uint32_t));
+    size_t *placed = (size_t *)malloc(n * sizeof(size_t));
+    size_t *start = (size_t *)malloc((p->buckets + 1) * sizeof(size_t));
+    uint32_t *order = (uint32_t *)malloc(p->buckets * sizeof(uint32_t));
+    size_t *by_size = (size_t *)malloc((n + 2) * sizeof(size_t));
+    uint64_t *taken = (uint64_t *)malloc(words * sizeof(uint64_t));
+    int rc = -1;
+    if (!p->pilots || !p->remap || !h2s || !bucket_of || !members || !placed ||
+        !start || !order || !by_size || !taken) {
+        goto out;
+    }
+
+    for (int attempt = 0; attempt < FREEZE_SEEDS && rc != 0; attempt++) {
+        p->seed = mix64(((uint64_t)index << 8) + (uint64_t)attempt + 1);
+
+        // Group keys by bucket (counting sort)
+        memset(start, 0, (p->buckets + 1) * sizeof(size_t));
+        for (size_t i = 0; i < n; i++) {
+            h2s[i] = mph_h2(p, keys[i].hash);
+            bucket_of[i] = (uint32_t)mph_bucket(p, mix64(keys[i].hash ^ p->seed));
+            start[bucket_of[i] + 1]++;
+        }
+        size_t largest = 0;
+        for (size_t b = 0; b < p->buckets; b++) {
+            if (start[b + 1] > largest) largest = start[b + 1];
+            start[b + 1] += start[b];
+        }
+        for (size_t i = 0; i < n; i++) placed[i] = start[bucket_of[i]]++;
+        for (size_t i = 0; i < n; i++) members[placed[i]] = (uint32_t)i;
+        for (size_t b = p->buckets; b > 0; b--) start[b] = start[b - 1];
+        start[0] = 0;
+
+        // Buckets by decreasing size (counting sort)
+        memset(by_size, 0, (largest + 2) * sizeof(size_t));
+        for (size_t b = 0; b < p->buckets; b++) by_size[largest - (start[b + 1] - start[b]) + 1]++;
+        for (size_t s = 0; s <= largest; s++) by_size[s + 1] += by_size[s];
+        for (size_t b = 0; b < p->buckets; b++) order[by_size[largest - (start[b + 1] - start[b])]++] = (uint32_t)b;
+
+        memset(taken, 0, words * sizeof(uint64_t));
+        int ok = 1;
+        for (size_t o = 0; o < p->buckets && ok; o++) {
+            size_t b = order[o];
+            size_t lo = start[b], hi = start[b + 1];
+            if (lo == hi) break;  // only empty buckets remain, their pilots stay defined
+
+            size_t pilot;
+            for (pilot = 0; pilot < FREEZE_PILOTS; pilot++) {
+                size_t k;
+                for (k = lo; k < hi; k++) {
+                    size_t pos = mph_slot(p, h2s[members[k]], (uint16_t)pilot);
+                    if (taken[pos >> 6] & (1ULL << (pos & 63))) break;
+                    taken[pos >> 6] |= 1ULL << (pos & 63);
+                    placed[k - lo] = pos;
+                }
+                if (k == hi) break;
+                while (k > lo) {
+                    k--;
+                    taken[placed[k - lo] >> 6] &= ~(1ULL << (placed[k - lo] & 63));
+                }
+            }
+            if (pilot == FREEZE_PILOTS) ok = 0;
+            else p->pilots[b] = (uint16_t)pilot;
+        }
+        if (ok) rc = 0;
+    }
+    if (rc != 0) goto out;
+
+    // Remap taken positions >= n onto the free positions < n, in order
+    size_t free_pos = 0;
+    for (size_t pos = n; pos < p->slots; pos++) {
+        if (!(taken[pos >> 6] & (1ULL << (pos & 63)))) continue;
+        while (taken[free_pos >> 6] & (1ULL << (free_pos & 63))) free_pos++;
+        p->remap[pos - n] = (uint32_t)free_pos++;
+    }
+
+    p->bytes = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t pos = mph_slot(p, h2s[i], p->pilots[bucket_of[i]]);
+        local[i] = (uint32_t)(pos < n ? pos : p->remap[pos - n]);
+        p->bytes += keys[i].length + 1;
+    }
+
+out:
+    free(h2s);
+    free(bucket_of);
+    free(members);
+    free(placed);
+    free(start);
+    free(order);
+    free(by_size);
+    free(taken);
+    return rc;
+}
+
+// Copy the keys of one partition to their positions
+static void mph_pack_partition(const MphPartition *p, const FreezeKey *keys, const uint32_t *local) {
+    size_t *offsets = g_frozen.offsets + p->offset;
+
+    // Lengths at offsets[local + 1], then a running sum from byte_base.
+    // offsets[0] belongs to the previous partition and is never touched.
+    for (size_t i = 0; i < p->keys; i++) offsets[local[i] + 1] = keys[i].length + 1;
+    size_t running = p->byte_base;
+    for (size_t j = 1; j <= p->keys; j++) {
+        running += offsets[j];
+        offsets[j] = running;
+    }
+
+    for (size_t i = 0; i < p->keys; i++) {
+        size_t at = local[i] == 0 ? p->byte_base : offsets[local[i]];
+        memcpy(g_frozen.bytes + at, keys[i].ptr, keys[i].length);
+        g_frozen.bytes[at + keys[i].length] = '\0';
+        g_frozen.slots[p->offset + local[i]] = keys[i].slot;
+    }
+}
+
+static void *freeze_worker(void *arg) {
+    FreezeShared *fs = (FreezeShared *)arg;
+    size_t part;
+    while ((part = atomic_fetch_add(&fs->next, 1)) < g_frozen.num_partitions) {
+        MphPartition *p = &g_frozen.parts[part];
+        const FreezeKey *keys = fs->keys + fs->part_start[part];
+        uint32_t *local = fs->local + fs->part_start[part];
+        if (fs->phase == 1) {
+            if (mph_build_partition(p, part, keys, local) != 0) atomic_store(&fs->failed, 1);
+        } else {
+            mph_pack_partition(p, keys, local);
+        }
+    }
+    return NULL;
+}
+
+static int freeze_run_phase(FreezeShared *fs, int phase, int nthreads) {
+    pthread_t *threads = (pthread_t *)malloc(nthreads * sizeof(pthread_t));
+    if (!threads) {
+        perror("Thread allocation failed");
+        return 1;
+    }
+    fs->phase = phase;
+    atomic_store(&fs->next, 0);
+    for (int t = 0; t < nthreads; ++t) spawn_thread(&threads[t], freeze_worker, fs);
+    for (int t = 0; t < nthreads; ++t) pthread_join(threads[t], NULL);
+    free(threads);
+    return 0;
+}
+
+// freeze action: build the index from the engine's live keys and report it
+static int freeze_table(const ProgramArgs *args, int op_index) {
+    printf("Freezing %zu live keys...\n", g_live_keys);
+    frozen_release();
+    if (g_pilot_hash[1] == 0) {
+        for (size_t i = 0; i < FREEZE_PILOTS; i++) g_pilot_hash[i] = mix64(i + 1);
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    FreezeCollect collect = { NULL, 0, 0, 0 };
+    if (g_engine->capacity() > 0) g_engine->for_each_key(freeze_collect, &collect);
+    size_t n = collect.count;
+    size_t parts = n / FREEZE_PARTITION_KEYS;
+    if (parts < 1) parts = 1;
+    int nthreads = args->threads < 1 ? 1 : args->threads;
+    if ((size_t)nthreads > parts) nthreads = (int)parts;
+
+    FreezeShared fs;
+    memset(&fs, 0, sizeof(fs));
+    fs.keys = (FreezeKey *)malloc((n + 1) * sizeof(FreezeKey));
+    fs.part_start = (size_t *)calloc(parts + 1, sizeof(size_t));
+    fs.local = (uint32_t *)malloc((n + 1) * sizeof(uint32_t));
+    g_frozen.parts = (MphPartition *)calloc(parts, sizeof(MphPartition));
+    g_frozen.num_partitions = parts;
+    g_frozen.count = n;
+    int rc = 1;
+    if (collect.failed || !fs.keys || !fs.part_start || !fs.local || !g_frozen.parts) {
+        perror("Memory allocation failed for freeze");
+        goto out;
+    }
+
+    // Group the keys by partition (counting sort)
+    for (size_t i = 0; i < n; i++) fs.part_start[mph_partition(collect.keys[i].hash, parts) + 1]++;
+    for (size_t q = 0; q < parts; q++) {
+        g_frozen.parts[q].offset = fs.part_start[q];
+        g_frozen.parts[q].keys = fs.part_start[q + 1];
+        fs.part_start[q + 1] += fs.part_start[q];
+    }
+    for (size_t i = 0; i < n; i++) {
+        size_t q = mph_partition(collect.keys[i].hash, parts);
+        fs.keys[g_frozen.parts[q].offset++] = collect.keys[i];
+    }
+    for (size_t q = 0; q < parts; q++) g_frozen.parts[q].offset = fs.part_start[q];
+
+    if (freeze_run_phase(&fs, 1, nthreads) != 0) goto out;
+    if (atomic_load(&fs.failed)) {
+        fprintf(stderr, "Error: freeze could not place all keys (allocation failed or duplicate hashes)\n");
+        goto out;
+    }
+
+    size_t total_bytes = 0;
+    for (size_t q = 0; q < parts; q++) {
+        g_frozen.parts[q].byte_base = total_bytes;
+        total_bytes += g_frozen.parts[q].bytes;
+    }
+    g_frozen.bytes = (char *)malloc(total_bytes + 1);
+    g_frozen.offsets = (size_t *)malloc((n + 1) * sizeof(size_t));
+    g_frozen.slots = (size_t *)malloc((n + 1) * sizeof(size_t));
+    if (!g_frozen.bytes || !g_frozen.offsets || !g_frozen.slots) {
+        perror("Memory allocation failed for freeze");
+        goto out;
+    }
+    g_frozen.offsets[0] = 0;
+    if (freeze_run_phase(&fs, 2, nthreads) != 0) goto out;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double build_ms = elapsed_seconds(&t0, &t1) * 1000.0;
+    g_frozen.valid = 1;
+    rc = 0;
+
+    size_t mph_bits = parts * sizeof(MphPartition) * 8;
+    for (size_t q = 0; q < parts; q++) {
+        const MphPartition *p = &g_frozen.parts[q];
+        if (p->keys) mph_bits += p->buckets * 16 + (p->slots - p->keys) * 32;
+    }
+    size_t index_bytes = mph_bits / 8 + total_bytes + (n + 1) * 2 * sizeof(size_t);
+    printf("Frozen index: %zu keys in %zu partitions, built in %.2f ms with %d threads; "
+           "MPH %.2f bits/key, index %.1f bytes/key (keys packed, %zu bytes)\n",
+           n, parts, build_ms, nthreads, n ? (double)mph_bits / (double)n : 0.0,
+           n ? (double)index_bytes / (double)n : 0.0, index_bytes);
+    if (write_operation_results(args, op_index, "freeze", 0, NULL, NULL, NULL, (long long)build_ms, 0) != 0) rc = 1;
+
+out:
+    free(collect.keys);
+    free(fs.keys);
+    free(fs.part_start);
+    free(fs.local);
+    if (rc != 0) frozen_release();
+    return rc;
+}
+
+// Worker for lookup steps served by the frozen index: one hash, one pilot
+// read and exactly one key comparison per key.
+static void *frozen_lookup_worker(void *arg) {
+    WorkerArgs *wa = (WorkerArgs *)arg;
+
+    for (size_t item = wa->start; item < wa->end; item++) {
+        const char *key = wa->meta[item].ptr;
+        size_t length = wa->meta[item].length;
+        uint64_t h = fnv1a64(key, length);
+        const MphPartition *p = &g_frozen.parts[mph_partition(h, g_frozen.num_partitions)];
+
+        wa->out_results[item] = 'F';
+        if (p->keys) {
+            size_t pos = mph_slot(p, mph_h2(p, h), p->pilots[mph_bucket(p, mix64(h ^ p->seed))]);
+            if (pos >= p->keys) pos = p->remap[pos - p->keys];
+            pos += p->offset;
+            size_t at = g_frozen.offsets[pos];
+            if (g_frozen.offsets[pos + 1] - at == length + 1 &&
+                memcmp(g_frozen.bytes + at, key, length) == 0) {
+                wa->out_indices[item] = g_frozen.slots[pos];
+                wa->out_results[item] = 'T';
+            }
+        }
+
+        size_t processed = item - wa->start + 1;
+        if (processed % PROGRESS_PUBLISH_INTERVAL == 0 || item + 1 == wa->end) {
+            atomic_store_explicit(&wa->progress->keys_done, processed, memory_order_relaxed);
+        }
+    }
+
+    *(wa->collision_count) = 0;
+    return NULL;
+}
+
+// lookup action: served by the frozen index when there is one, timed
+// against the same lookups on the live table (lock and disk engines)
+static int lookup_operation(const ProgramArgs *args, int op_index, size_t lineCount, StringMetadata *metadata) {
+    if (!g_frozen.valid) return execute_hash_operation(args, op_index, "lookup", lineCount, metadata);
+
+    printf("Looking up %zu records in the frozen index...\n", lineCount);
+    size_t *indices = (size_t *)pool_get(POOL_INDICES, lineCount * sizeof(size_t), 0);
+    char *results = (char *)pool_get(POOL_RESULTS, lineCount * sizeof(char), 0);
+    if (!indices || !results) {
+        perror("Memory allocation failed for results");
+        return 1;
+    }
+
+    // Live-table baseline first, kept aside to cross-check the index
+    int live = engine_has_lookup(g_engine->name) && g_engine->capacity() > 0;
+    char *live_results = live ? (char *)malloc(lineCount) : NULL;
+    size_t *live_indices = live ? (size_t *)malloc(lineCount * sizeof(size_t)) : NULL;
+    long long elapsed_ms = 0;
+    size_t live_collisions = 0, total_collisions = 0;
+    double live_secs = 0.0;
+    struct timespec t0, t1;
+    if (live) {
+        if (!live_results || !live_indices) {
+            perror("Memory allocation failed for results");
+            free(live_results);
+            free(live_indices);
+            return 1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        if (run_hash_step(args, op_index, "lookup", lineCount, metadata,
+                          indices, results, &elapsed_ms, &live_collisions) != 0) {
+            free(live_results);
+            free(live_indices);
+            return 1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        live_secs = elapsed_seconds(&t0, &t1);
+        memcpy(live_results, results, lineCount);
+        memcpy(live_indices, indices, lineCount * sizeof(size_t));
+    }
+
+    g_step_worker = frozen_lookup_worker;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int rc = run_hash_step(args, op_index, "lookup", lineCount, metadata,
+                           indices, results, &elapsed_ms, &total_collisions);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    g_step_worker = NULL;
+    if (rc != 0) {
+        free(live_results);
+        free(live_indices);
+        return 1;
+    }
+    double secs = elapsed_seconds(&t0, &t1);
+    calibration_report_step("lookup", lineCount, total_collisions, secs);
+
+    size_t found = 0;
+    for (size_t j = 0; j < lineCount; j++) found += results[j] == 'T';
+    printf("Lookup: frozen index %.1f M keys/s (%.2f ms, %zu found)",
+           secs > 0.0 ? (double)lineCount / secs / 1e6 : 0.0, secs * 1000.0, found);
+    if (live) {
+        size_t mismatches = 0;
+        for (size_t j = 0; j < lineCount; j++) {
+            if (results[j] != live_results[j] || (results[j] == 'T' && indices[j] != live_indices[j])) mismatches++;
+        }
+        printf(", live table %.1f M keys/s (%.2f ms, %zu probes), %.2fx",
+               live_secs > 0.0 ? (double)lineCount / live_secs / 1e6 : 0.0, live_secs * 1000.0,
+               live_collisions, secs > 0.0 ? live_secs / secs : 0.0);
+        if (mismatches) printf(", %zu MISMATCHES", mismatches);
+    }
+    printf("\n");
+    free(live_results);
+    free(live_indices);
+
+    return write_operation_results(args, op_index, "lookup", lineCount, metadata,
+                                   indices, results, elapsed_ms, total_collisions);
+}
+
+// ------------------------------------------------------------------------
+// Set actions (union / intersect / difference). Their input is a pair
+// "<left>,<right>" of tables: names given with --table, or plain files.
+// A table is its own loaded input plus a read-only hash set over it, built
+// in parallel on first use and kept for the rest of the flow, so comparing
+// one file against several others loads and hashes it once. The set holds
+// the smallest record index of every key; a record is emitted only at its
+// first occurrence, so results are distinct keys in input order. One pass
+// runs per operand side: intersect/difference walk left and probe right,
+// union walks left and then the right-only keys of right. Every thread
+// formats its share into a private buffer; buffers are written in order.
+
+typedef struct {
+    char *name;               // --table name, or the path of an unnamed operand
+    Dataset ds;               // owned input, never cached or pooled
+    _Atomic size_t *slots;    // record index + 1, 0 -> empty
+    size_t mask;
+    size_t distinct;
+} SetTable;
+
+static SetTable g_set_tables[SET_MAX_TABLES];
+static int g_set_table_count = 0;
+
+// Arguments for one set-table build thread
+typedef struct {
+    SetTable *table;
+    size_t start;             // inclusive record index
+    size_t end;               // exclusive
+    size_t distinct;          // keys first placed by this thread
+} SetBuildArgs;
+
+// One thread's share of a set pass: records [start, end) of walk, kept
+// when their presence in probe equals want_present (probe NULL -> all)
+typedef struct {
+    const SetTable *walk;
+    const SetTable *probe;
+    int want_present;
+    size_t start;
+    size_t end;
+    char *out;                // private output buffer
+    size_t out_len;
+    size_t out_cap;
+    size_t keys;
+    size_t probes;            // extra slots visited
+    int failed;
+} SetPassArgs;
+
+static inline size_t set_home(const SetTable *t, const char *key, size_t length) {
+    return (size_t)mix64(fnv1a64(key, length)) & t->mask;
+}
+
+// Record index + 1 of key in t, 0 if absent
+static size_t set_find(const SetTable *t, const char *key, size_t length, size_t *probes) {
+    size_t pos = set_home(t, key, length);
+    while (1) {
+        size_t cur = atomic_load_explicit(&t->slots[pos], memory_order_relaxed);
+        if (cur == 0) return 0;
+        const StringMetadata *m = &t->ds.metadata[cur - 1];
+        if (m->length == length && memcmp(m->ptr, key, length) == 0) return cur;
+        (*probes)++;
+        pos = (pos + 1) & t->mask;
+    }
+}
+
+static void *set_build_worker(void *arg) {
+    SetBuildArgs *ba = (SetBuildArgs *)arg;
+    SetTable *t = ba->table;
+
+    for (size_t j = ba->start; j < ba->end; j++) {
+        const StringMetadata *m = &t->ds.metadata[j];
+        size_t pos = set_home(t, m->ptr, m->length);
+        while (1) {
+            size_t cur = atomic_load_explicit(&t->slots[pos], memory_order_acquire);
+            if (cur == 0) {
+                if (atomic_compare_exchange_weak_explicit(&t->slots[pos], &cur, j + 1,
+                                                          memory_order_release, memory_order_relaxed)) {
+                    ba->distinct++;
+                    break;
+                }
+                continue;  // reread the slot
+            }
+            const StringMetadata *other = &t->ds.metadata[cur - 1];
+            if (other->length == m->length && memcmp(other->ptr, m->ptr, m->length) == 0) {
+                // Same key: keep the smallest index (atomic min)
+                while (cur > j + 1 &&
+                       !atomic_compare_exchange_weak_explicit(&t->slots[pos], &cur, j + 1,
+                                                              memory_order_release, memory_order_relaxed)) {
+                }
+                break;
+            }
+            pos = (pos + 1) & t->mask;
+        }
+    }
+    return NULL;
+}
+
+// Find or load and hash the table called name (a --table name or a path)
+static SetTable *get_set_table(const ProgramArgs *args, const char *name) {
+    for (int i = 0; i < g_set_table_count; i++) {
+        if (strcmp(g_set_tables[i].name, name) == 0) return &g_set_tables[i];
+    }
+    if (g_set_table_count == SET_MAX_TABLES) {
+        fprintf(stderr, "Error: Too many tables (max %d)\n", SET_MAX_TABLES);
+        return NULL;
+    }
+
+    const char *path = name;
+    for (int i = 0; i < args->num_tables; i++) {
+        if (strcmp(args->table_name[i], name) == 0) path = args->table_file[i];
+    }
+
+    SetTable *t = &g_set_tables[g_set_table_count];
+    memset(t, 0, sizeof(*t));
+    t->name = strdup(name);
+    t->ds.path = strdup(path);
+    if (!t->name || !t->ds.path) {
+        perror("Memory allocation failed for table");
+        free(t->name);
+        free(t->ds.path);
+        return NULL;
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    const char *used = NULL;
+    if (load_dataset(&t->ds, args->reader, (size_t)-1, &used) != 0) {
+        free(t->name);
+        free(t->ds.path);
+        return NULL;
+    }
+
+    size_t n = t->ds.lineCount;
+    size_t size = 16;
+    while (size < 2 * n) size <<= 1;
+    t->mask = size - 1;
+    t->slots = (_Atomic size_t *)calloc(size, sizeof(size_t));
+    int nthreads = args->threads < 1 ? 1 : args->threads;
+    if ((size_t)nthreads > n) nthreads = n ? (int)n : 1;
+    pthread_t *threads = (pthread_t *)malloc(nthreads * sizeof(pthread_t));
+    SetBuildArgs *bargs = (SetBuildArgs *)calloc(nthreads, sizeof(SetBuildArgs));
+    if (!t->slots || !threads || !bargs) {
+        perror("Memory allocation failed for table");
+        free(threads);
+        free(bargs);
+        free((void *)t->slots);
+        free(t->name);
+        free_dataset(&t->ds);
+        return NULL;
+    }
+
+    size_t chunk = (n + nthreads - 1) / nthreads;
+    for (int th = 0; th < nthreads; th++) {
+        size_t start = th * chunk;
+        size_t end = start + chunk;
+        if (start > n) start = n;
+        if (end > n) end = n;
+        bargs[th] = (SetBuildArgs){ .table = t, .start = start, .end = end, .distinct = 0 };
+        spawn_thread(&threads[th], set_build_worker, &bargs[th]);
+    }
+    for (int th = 0; th < nthreads; th++) {
+        pthread_join(threads[th], NULL);
+        t->distinct += bargs[th].distinct;
+    }
+    free(threads);
+    free(bargs);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    g_set_table_count++;
+    printf("Table %s: %s, %zu records, %zu distinct keys, loaded via %s and hashed in %.2f ms\n",
+           t->name, t->ds.path, n, t->distinct, used, elapsed_seconds(&t0, &t1) * 1000.0);
+    return t;
+}
+
+static int set_append(SetPassArgs *pa, const char *key, size_t length) {
+    size_t need = pa->out_len + length + 2;
+    if (need > pa->out_cap) {
+        size_t cap = pa->out_cap ? pa->out_cap * 2 : 64 * 1024;
+        while (cap < need) cap *= 2;
+        char *out = (char *)realloc(pa->out, cap);
+        if (!out) return 1;
+        pa->out = out;
+        pa->out_cap = cap;
+    }
+    if (pa->out_len) {
+        pa->out[pa->out_len++] = ',';
+        pa->out[pa->out_len++] = ' ';
+    }
+    memcpy(pa->out + pa->out_len, key, length);
+    pa->out_len += length;
+    return 0;
+}
+
+static void *set_pass_worker(void *arg) {
+    SetPassArgs *pa = (SetPassArgs *)arg;
+    const StringMetadata *meta = pa->walk->ds.metadata;
+
+    for (size_t j = pa->start; j < pa->end; j++) {
+        if (set_find(pa->walk, meta[j].ptr, meta[j].length, &pa->probes) != j + 1) continue;  // repeat
+        if (pa->probe && (set_find(pa->probe, meta[j].ptr, meta[j].length, &pa->probes) != 0) != pa->want_present) {
+            continue;
+        }
+        if (set_append(pa, meta[j].ptr, meta[j].length) != 0) {
+            pa->failed = 1;
+            break;
+        }
+        pa->keys++;
+    }
+    return NULL;
+}
+
+// Write a set action's section from the per-thread buffers, in order;
+// nonzero if the file could not be written completely
+static int write_set_results(const ProgramArgs *args, int op_index, const char *action,
+                              const SetPassArgs *parts, int nparts,
+                              long long elapsed_ms, size_t probes) {
+    char outfile[512];
+    results_path(args, outfile, sizeof(outfile));
+
+    char *text = NULL;
+    size_t text_len = 0;
+    FILE *out = args->compress_results ? open_memstream(&text, &text_len)
+                                       : fopen(outfile, (op_index == 0) ? "w" : "a");
+    if (!out) {
+        perror("Cannot open results file");
+        return 1;
+    }
 
-                tablePos = (tablePos + 1) % g_table_size;
-            }
-        }
+    write_results_header(out, action, elapsed_ms, probes);
+    int first = 1;
+    for (int p = 0; p < nparts; p++) {
+        if (!parts[p].out_len) continue;
+        if (!first) fputs(", ", out);
+        fwrite(parts[p].out, 1, parts[p].out_len, out);
+        first = 0;
+    }
+    fprintf(out, "\n");
+    int rc = 0;
+    if (fclose(out) != 0) {
+        perror("Cannot write results file");
+        rc = 1;
     }
 
-    *(workerArg->collision_count) = thread_collisions;
-    return NULL;
+    if (args->compress_results) {
+        if (rc == 0) rc = write_gzip_members(outfile, (op_index == 0) ? "w" : "a", text, text_len, args->threads);
+        free(text);
+    }
+    return rc;
 }
 
-int preprocess(const char *filename, size_t *lineCount, size_t *totalDataSize) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        perror("Error opening file");
+// union / intersect / difference of the two tables named in spec
+static int set_operation(const ProgramArgs *args, int op_index, const char *action, const char *spec) {
+    const char *comma = strchr(spec, ',');
+    char left_name[512];
+    snprintf(left_name, sizeof(left_name), "%.*s", (int)(comma - spec), spec);
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    SetTable *left = get_set_table(args, left_name);
+    SetTable *right = left ? get_set_table(args, comma + 1) : NULL;
+    if (!right) return 1;
+    // Tables keep the splitter that loaded them (fgets, or a kernel for .gz)
+    g_step_scan = strcmp(left->ds.scan, right->ds.scan) == 0 ? left->ds.scan : "mixed";
+
+    // Passes: intersect = left in right, difference = left not in right,
+    // union = all of left, then right not in left
+    SetPassArgs pass[2] = {
+        { .walk = left, .probe = right, .want_present = strcmp(action, "intersect") == 0 },
+        { .walk = right, .probe = left, .want_present = 0 }
+    };
+    int npasses = 1;
+    if (strcmp(action, "union") == 0) {
+        pass[0].probe = NULL;
+        npasses = 2;
+    }
+
+    int nthreads = args->threads < 1 ? 1 : args->threads;
+    int nparts = npasses * nthreads;
+    SetPassArgs *parts = (SetPassArgs *)calloc(nparts, sizeof(SetPassArgs));
+    pthread_t *threads = (pthread_t *)malloc(nparts * sizeof(pthread_t));
+    if (!parts || !threads) {
+        perror("Memory allocation failed for set action");
+        free(parts);
+        free(threads);
         return 1;
     }
 
-    char line[1024];
-    *lineCount = 0;
-    *totalDataSize = 0;
+    struct timespec p0;
+    clock_gettime(CLOCK_MONOTONIC, &p0);
+    for (int s = 0; s < npasses; s++) {
+        size_t n = pass[s].walk->ds.lineCount;
+        size_t chunk = (n + nthreads - 1) / nthreads;
+        for (int th = 0; th < nthreads; th++) {
+            SetPassArgs *pa = &parts[s * nthreads + th];
+            *pa = pass[s];
+            pa->start = th * chunk;
+            pa->end = pa->start + chunk;
+            if (pa->start > n) pa->start = n;
+            if (pa->end > n) pa->end = n;
+            spawn_thread(&threads[s * nthreads + th], set_pass_worker, pa);
+        }
+    }
+    size_t keys = 0, probes = 0;
+    int failed = 0;
+    for (int p = 0; p < nparts; p++) {
+        pthread_join(threads[p], NULL);
+        keys += parts[p].keys;
+        probes += parts[p].probes;
+        failed |= parts[p].failed;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
 
-    while (fgets(line, sizeof(line), file)) {
-        (*lineCount)++;
-        *totalDataSize += strlen(line);
+    int rc = 0;
+    if (failed) {
+        perror("Memory allocation failed for set output");
+        rc = 1;
+    } else {
+        double pass_secs = elapsed_seconds(&p0, &t1);
+        size_t walked = left->ds.lineCount + (npasses == 2 ? right->ds.lineCount : 0);
+        printf("%s %s,%s: %zu keys (%zu and %zu distinct), pass %.2f ms, %.1f M records/s\n",
+               action, left->name, right->name, keys, left->distinct, right->distinct,
+               pass_secs * 1000.0, pass_secs > 0.0 ? (double)walked / pass_secs / 1e6 : 0.0);
+        long long elapsed_ms = (t1.tv_sec - t0.tv_sec) * 1000LL + (t1.tv_nsec - t0.tv_nsec) / 1000000LL;
+        rc = write_set_results(args, op_index, action, parts, nparts, elapsed_ms, probes);
     }
 
-    fclose(file);
-    return 0;
+    for (int p = 0; p < nparts; p++) free(parts[p].out);
+    free(parts);
+    free(threads);
+    return rc;
 }
 
-int allocate_memory(size_t lineCount, size_t totalDataSize, StringMetadata **metadata, char **data) {
-    *metadata = (StringMetadata *)malloc(lineCount * sizeof(StringMetadata));
-    if (!*metadata) {
-        perror("Memory allocation failed for metadata");
-        return 1;
+static void release_set_tables(void) {
+    for (int i = 0; i < g_set_table_count; i++) {
+        free((void *)g_set_tables[i].slots);
+        free(g_set_tables[i].name);
+        free_dataset(&g_set_tables[i].ds);
     }
+    g_set_table_count = 0;
+}
 
-    *data = (char *)malloc(totalDataSize + 1);
-    if (!*data) {
-        perror("Memory allocation failed for data");
-        free(*metadata);
-        return 1;
-    }
+// ------------------------------------------------------------------------
+// Heavy hitters (topk action): the most frequent keys of an input without
+// storing every key. The input is never loaded: each thread streams the
+// lines starting in its byte range of the file through a READ_CHUNK_SIZE
+// window (a .gz file is inflated by one thread) and runs a Space-Saving
+// summary of m counters (--sketch_counters) over them: a tracked key counts
+// up; a new key takes over the minimum counter, inheriting its count as
+// error, and only then is its text copied into the counter. Counters
+// sit in a min-heap with an open-addressing index on the keys. Summaries
+// are merged as mergeable summaries (Agarwal et al.): a key absent from a
+// full summary is charged that summary's minimum in both count and error.
+// The merged count c of a key bounds its true frequency f by
+// c - err <= f <= c, and err <= N/m for N records.
 
-    return 0;
+typedef struct {
+    char *key;                // owned copy, key_cap bytes allocated
+    size_t length;
+    size_t key_cap;
+    uint64_t hash;
+    size_t count;
+    size_t err;               // overestimation bound
+} HhCounter;
+
+// One thread's Space-Saving summary over the lines starting in input bytes
+// [start, end)
+typedef struct {
+    const char *path;
+    int compressed;           // read through zlib, start 0 and end SIZE_MAX
+    size_t start;
+    size_t end;
+    size_t records;
+    int error;
+    size_t capacity;          // m
+    size_t used;
+    HhCounter *counters;
+    uint32_t *heap;           // counter indices, smallest count first
+    uint32_t *heap_pos;       // counter index -> heap position
+    int32_t *index;           // key slots: counter index, -1 -> empty
+    size_t mask;
+    size_t probes;
+    size_t key_bytes;         // held by the key copies
+} HhSketch;
+
+// A merged candidate; present_min sums the minimums of the summaries that
+// track the key, so absent summaries are charged total_min - present_min
+typedef struct {
+    const char *key;
+    size_t length;
+    uint64_t hash;
+    size_t count;
+    size_t err;
+    size_t present_min;
+} HhEntry;
+
+static void hh_sift_down(HhSketch *s, size_t pos) {
+    uint32_t c = s->heap[pos];
+    while (1) {
+        size_t child = 2 * pos + 1;
+        if (child >= s->used) break;
+        if (child + 1 < s->used && s->counters[s->heap[child + 1]].count < s->counters[s->heap[child]].count) child++;
+        if (s->counters[s->heap[child]].count >= s->counters[c].count) break;
+        s->heap[pos] = s->heap[child];
+        s->heap_pos[s->heap[pos]] = (uint32_t)pos;
+        pos = child;
+    }
+    s->heap[pos] = c;
+    s->heap_pos[c] = (uint32_t)pos;
 }
 
-int read_data(const char *filename, size_t lineCount, StringMetadata *metadata, char *data) {
-    FILE *file = fopen(filename, "r");
-    if (!file) {
-        perror("Error opening file");
-        return 1;
+// Place counter c at pos and move it towards the root
+static void hh_sift_up(HhSketch *s, size_t pos, uint32_t c) {
+    while (pos > 0) {
+        size_t parent = (pos - 1) / 2;
+        if (s->counters[s->heap[parent]].count <= s->counters[c].count) break;
+        s->heap[pos] = s->heap[parent];
+        s->heap_pos[s->heap[pos]] = (uint32_t)pos;
+        pos = parent;
     }
+    s->heap[pos] = c;
+    s->heap_pos[c] = (uint32_t)pos;
+}
 
-    char line[1024];
-    size_t totalDataAllocated = 0;
-    size_t totalStrings = 0;
+// Slot holding key, or the empty slot where it would go
+static size_t hh_find(HhSketch *s, const char *key, size_t length, uint64_t hash) {
+    size_t pos = (size_t)hash & s->mask;
+    while (s->index[pos] >= 0) {
+        const HhCounter *c = &s->counters[s->index[pos]];
+        if (c->hash == hash && c->length == length && memcmp(c->key, key, length) == 0) break;
+        s->probes++;
+        pos = (pos + 1) & s->mask;
+    }
+    return pos;
+}
 
-    while (fgets(line, sizeof(line), file) && totalStrings < lineCount) {
-        size_t len = strlen(line);
-        if (line[len - 1] == '\n') {
-            line[len - 1] = '\0';
-            len--;
+// Remove counter c from the index (backward-shift deletion)
+static void hh_unindex(HhSketch *s, uint32_t c) {
+    size_t i = (size_t)s->counters[c].hash & s->mask;
+    while (s->index[i] != (int32_t)c) i = (i + 1) & s->mask;
+    size_t j = i;
+    while (1) {
+        j = (j + 1) & s->mask;
+        if (s->index[j] < 0) break;
+        size_t home = (size_t)s->counters[s->index[j]].hash & s->mask;
+        // Move j back to i unless its home lies cyclically in (i, j]
+        int stays = i <= j ? (home > i && home <= j) : (home > i || home <= j);
+        if (!stays) {
+            s->index[i] = s->index[j];
+            i = j;
         }
+    }
+    s->index[i] = -1;
+}
 
-        memcpy(data + totalDataAllocated, line, len);
-        data[totalDataAllocated + len] = '\0';
+// Count one record; a key is copied only when it takes over a counter
+static int hh_add(HhSketch *s, const char *key, size_t length) {
+    uint64_t hash = mix64(fnv1a64(key, length));
+    size_t slot = hh_find(s, key, length, hash);
+    s->records++;
 
-        metadata[totalStrings].ptr = data + totalDataAllocated;
-        metadata[totalStrings].length = len;
+    if (s->index[slot] >= 0) {
+        uint32_t c = (uint32_t)s->index[slot];
+        s->counters[c].count++;
+        hh_sift_down(s, s->heap_pos[c]);
+        return 0;
+    }
 
-        totalDataAllocated += len + 1;
-        totalStrings++;
+    // A free counter, else the minimum one
+    uint32_t c = s->used < s->capacity ? (uint32_t)s->used : s->heap[0];
+    HhCounter *hc = &s->counters[c];
+    if (hc->key_cap < length) {
+        size_t cap = length < 16 ? 16 : length;
+        char *grown = (char *)realloc(hc->key, cap);
+        if (!grown) return 1;
+        s->key_bytes += cap - hc->key_cap;
+        hc->key = grown;
+        hc->key_cap = cap;
     }
 
-    fclose(file);
+    if (s->used < s->capacity) {
+        s->used++;
+        memcpy(hc->key, key, length);
+        hc->length = length;
+        hc->hash = hash;
+        hc->count = 1;
+        hc->err = 0;
+        s->index[slot] = (int32_t)c;
+        hh_sift_up(s, s->used - 1, c);
+    } else {
+        // Take over the minimum counter, its count becomes the error
+        size_t min = hc->count;
+        hh_unindex(s, c);
+        memcpy(hc->key, key, length);
+        hc->length = length;
+        hc->hash = hash;
+        hc->count = min + 1;
+        hc->err = min;
+        s->index[hh_find(s, key, length, hash)] = (int32_t)c;
+        hh_sift_down(s, 0);
+    }
     return 0;
 }
 
-// Helper function to write operation results to file
-static void write_operation_results(const ProgramArgs *args, int op_index, const char *action,
-                                   size_t lineCount, StringMetadata *metadata, 
-                                   size_t *indices, char *results, 
-                                   long long elapsed_ms, size_t total_collisions) {
-    // Build flow string for filename
-    char flow[256] = "";
-    for (int j = 0; j < args->num_operations; ++j) {
-        strcat(flow, args->action[j]);
-        if (j + 1 < args->num_operations) strcat(flow, "_");
+static void *hh_worker(void *arg) {
+    HhSketch *s = (HhSketch *)arg;
+    size_t cap = READ_CHUNK_SIZE;
+    char *buf = (char *)malloc(cap);
+    int fd = -1;
+    gzFile gz = NULL;
+    if (s->compressed) gz = gzopen(s->path, "rb");
+    else fd = open(s->path, O_RDONLY);
+    if (!buf || (s->compressed ? !gz : fd < 0)) {
+        s->error = 1;
+        goto out;
     }
 
-    // Write results to file
-    char outfile[512];
-    char data_size_str[32], tsize_str[32];
-    deparse_size(args->data_size, data_size_str, sizeof(data_size_str));
-    deparse_size(args->tsize, tsize_str, sizeof(tsize_str));
-    snprintf(outfile, sizeof(outfile),
-             "results/Results_HW2_MCC_030402_401106039_%s_%d_%s_%s.txt",
-             data_size_str, args->threads, tsize_str, flow);
-
-    FILE *out = fopen(outfile, (op_index == 0) ? "w" : "a");
-    if (!out) {
-        perror("Cannot open results file");
-        return;
+    // A range starting mid-line leaves that line to the previous thread
+    int skip = 0;
+    if (s->start > 0) {
+        char prev;
+        if (pread(fd, &prev, 1, (off_t)(s->start - 1)) != 1) {
+            s->error = 1;
+            goto out;
+        }
+        skip = prev != '\n';
     }
 
-    fprintf(out, "Actions: %s\n", action);
-    fprintf(out, "ExecutionTime: %lld ms\n", elapsed_ms);
-    fprintf(out, "NumberOfHandledCollision: %zu\n", total_collisions);
+    size_t pos = s->start;    // input offset of buf[0]
+    size_t have = 0;
+    int eof = 0;
+    while (!s->error) {
+        if (!eof) {
+            ssize_t got = gz ? (ssize_t)gzread(gz, buf + have, (unsigned)(cap - have))
+                             : pread(fd, buf + have, cap - have, (off_t)(pos + have));
+            if (got < 0 && !gz && errno == EINTR) continue;
+            if (got < 0) {
+                s->error = 1;
+                break;
+            }
+            if (got == 0) eof = 1;
+            have += (size_t)got;
+        }
 
-    if (strcmp(action, "insert") == 0) {
-        for (size_t j = 0; j < lineCount; ++j) {
-            fprintf(out, "%s:%zu:%c", metadata[j].ptr, indices[j], results[j]);
-            if (j + 1 < lineCount) fprintf(out, ", ");
+        size_t off = 0;
+        int finished = 0;
+        while (off < have) {
+            if (!skip && pos + off >= s->end) {
+                finished = 1;
+                break;
+            }
+            const char *line = buf + off;
+            const char *nl = (const char *)g_kernels.scan_newline(line, have - off);
+            if (!nl && !eof) break;
+            size_t len = nl ? (size_t)(nl - line) : have - off;
+            if (skip) {
+                skip = 0;
+            } else if (hh_add(s, line, len) != 0) {
+                s->error = 1;
+                break;
+            }
+            off += len + (nl ? 1 : 0);
         }
-    } else if (strcmp(action, "delete") == 0) {
-        // For delete: only output successful deletions
-        int first = 1;
-        for (size_t j = 0; j < lineCount; ++j) {
-            if (results[j] == 'T') { // Successfully deleted
-                if (!first) fprintf(out, ", ");
-                fprintf(out, "%s:%zu:%c", metadata[j].ptr, indices[j], results[j]);
-                first = 0;
-            } else {
-                // Failed deletion: only output Data:F
-                if (!first) fprintf(out, ", ");
-                fprintf(out, "%s:%c", metadata[j].ptr, results[j]);
-                first = 0;
+        if (finished || eof) break;
+
+        if (off == 0 && have == cap) {
+            // One line fills the window: widen it
+            char *grown = (char *)realloc(buf, cap * 2);
+            if (!grown) {
+                s->error = 1;
+                break;
             }
+            buf = grown;
+            cap *= 2;
+        } else {
+            memmove(buf, buf + off, have - off);
+            pos += off;
+            have -= off;
         }
     }
 
-    fprintf(out, "\n");
-    fclose(out);
+out:
+    // gzclose_r reports a file that ends inside a member
+    if (gz && gzclose_r(gz) != Z_OK) s->error = 1;
+    if (fd >= 0) close(fd);
+    free(buf);
+    return NULL;
 }
 
-// Helper function to execute hash operation (insert or delete)
-static int execute_hash_operation(const ProgramArgs *args, int op_index, const char *action,
-                                 size_t lineCount, StringMetadata *metadata) {
-    printf("%s %zu records...\n", 
-           (strcmp(action, "insert") == 0) ? "Inserting" : "Deleting", lineCount);
+static int hh_entry_cmp_key(const void *a, const void *b) {
+    const HhEntry *x = (const HhEntry *)a, *y = (const HhEntry *)b;
+    if (x->hash != y->hash) return x->hash < y->hash ? -1 : 1;
+    if (x->length != y->length) return x->length < y->length ? -1 : 1;
+    return memcmp(x->key, y->key, x->length);
+}
 
-    // Ensure hash table and locks are initialized
-    if (ensure_table_and_locks(args->tsize) != 0) {
-        return 1;
-    }
+static int hh_entry_cmp_count(const void *a, const void *b) {
+    const HhEntry *x = (const HhEntry *)a, *y = (const HhEntry *)b;
+    if (x->count != y->count) return x->count > y->count ? -1 : 1;
+    if (x->err != y->err) return x->err < y->err ? -1 : 1;
+    return hh_entry_cmp_key(a, b);
+}
 
-    // Allocate arrays for results
-    size_t *indices = (size_t *)malloc(lineCount * sizeof(size_t));
-    char *results = (char *)malloc(lineCount * sizeof(char));
-    if (!indices || !results) {
-        perror("Memory allocation failed for results");
-        free(indices);
-        free(results);
+// topk action: per-thread sketches streamed from the input file, merged
+// into top-K
+static int heavy_hitters(const ProgramArgs *args, int op_index, const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        perror("Error opening file");
         return 1;
     }
+    size_t size = (size_t)st.st_size;
+    int compressed = has_suffix(path, ".gz");
 
-    // Setup threading
-    int nthreads = args->threads;
-    if (nthreads < 1) nthreads = 1;
-    if ((size_t)nthreads > lineCount) nthreads = (int)lineCount;
+    size_t m = args->sketch_counters;
+    if (m < args->topk) m = args->topk;
+    int nthreads = args->threads < 1 ? 1 : args->threads;
+    if (compressed) nthreads = 1;
+    else if ((size_t)nthreads > size / HH_MIN_RANGE_BYTES + 1) nthreads = (int)(size / HH_MIN_RANGE_BYTES + 1);
+    printf("Counting heavy hitters in %s (%d x %zu counters)...\n", path, nthreads, m);
 
+    size_t slots = 16;
+    while (slots < 2 * m) slots <<= 1;
+
+    HhSketch *sketches = (HhSketch *)calloc(nthreads, sizeof(HhSketch));
     pthread_t *threads = (pthread_t *)malloc(nthreads * sizeof(pthread_t));
-    WorkerArgs *wargs = (WorkerArgs *)malloc(nthreads * sizeof(WorkerArgs));
-    size_t *thread_collisions = (size_t *)calloc(nthreads, sizeof(size_t));
+    HhEntry *entries = (HhEntry *)malloc((size_t)nthreads * m * sizeof(HhEntry));
+    int rc = 1;
+    int failed = 0;                // a reader or the results write failed, already reported
+    if (!sketches || !threads || !entries) goto out;
+    for (int t = 0; t < nthreads; t++) {
+        HhSketch *s = &sketches[t];
+        s->capacity = m;
+        s->mask = slots - 1;
+        s->counters = (HhCounter *)calloc(m, sizeof(HhCounter));
+        s->heap = (uint32_t *)malloc(m * sizeof(uint32_t));
+        s->heap_pos = (uint32_t *)malloc(m * sizeof(uint32_t));
+        s->index = (int32_t *)malloc(slots * sizeof(int32_t));
+        if (!s->counters || !s->heap || !s->heap_pos || !s->index) goto out;
+        memset(s->index, 0xff, slots * sizeof(int32_t));
+    }
 
-    if (!threads || !wargs || !thread_collisions) {
-        perror("Thread allocation failed");
-        free(threads);
-        free(wargs);
-        free(thread_collisions);
-        free(indices);
-        free(results);
-        return 1;
+    struct timespec t0, t1, t2;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    size_t chunk = (size + nthreads - 1) / nthreads;
+    for (int t = 0; t < nthreads; t++) {
+        HhSketch *s = &sketches[t];
+        s->path = path;
+        s->compressed = compressed;
+        s->start = t * chunk;
+        s->end = compressed ? SIZE_MAX : s->start + chunk;
+        if (s->start > size) s->start = size;
+        if (s->end > size && !compressed) s->end = size;
+        spawn_thread(&threads[t], hh_worker, s);
     }
+    for (int t = 0; t < nthreads; t++) pthread_join(threads[t], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
 
-    size_t chunk = (lineCount + nthreads - 1) / nthreads;
+    size_t lineCount = 0;
+    for (int t = 0; t < nthreads; t++) {
+        lineCount += sketches[t].records;
+        failed |= sketches[t].error;
+    }
+    if (failed) {
+        fprintf(stderr, "Error reading input %s\n", path);
+        goto out;
+    }
+    if (lineCount == 0) {
+        printf("File %s is empty.\n", path);
+        rc = 0;
+        goto out;
+    }
 
-    // Start timing
-    struct timespec t0, t1;
-    clock_gettime(CLOCK_MONOTONIC, &t0);
+    // Merge: group counters by key, charge absent full summaries their minimum
+    size_t n = 0, total_min = 0, probes = 0;
+    for (int t = 0; t < nthreads; t++) {
+        const HhSketch *s = &sketches[t];
+        size_t min = s->used == s->capacity ? s->counters[s->heap[0]].count : 0;
+        total_min += min;
+        probes += s->probes;
+        for (size_t c = 0; c < s->used; c++) {
+            const HhCounter *hc = &s->counters[c];
+            entries[n++] = (HhEntry){ hc->key, hc->length, hc->hash, hc->count, hc->err, min };
+        }
+    }
+    qsort(entries, n, sizeof(HhEntry), hh_entry_cmp_key);
+    size_t merged = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (merged > 0 && hh_entry_cmp_key(&entries[merged - 1], &entries[i]) == 0) {
+            entries[merged - 1].count += entries[i].count;
+            entries[merged - 1].err += entries[i].err;
+            entries[merged - 1].present_min += entries[i].present_min;
+        } else {
+            entries[merged++] = entries[i];
+        }
+    }
+    for (size_t i = 0; i < merged; i++) {
+        entries[i].count += total_min - entries[i].present_min;
+        entries[i].err += total_min - entries[i].present_min;
+    }
+    qsort(entries, merged, sizeof(HhEntry), hh_entry_cmp_count);
+    clock_gettime(CLOCK_MONOTONIC, &t2);
 
-    // Create and start worker threads
-    for (int t = 0; t < nthreads; ++t) {
-        size_t start = t * chunk;
-        size_t end = start + chunk;
-        if (end > lineCount) end = lineCount;
+    size_t k = args->topk < merged ? args->topk : merged;
+    // Any key outside the list occurs at most this often
+    size_t outside = merged > k ? entries[k].count : 0;
+    if (total_min > outside) outside = total_min;
+    size_t max_err = 0;
+    for (size_t i = 0; i < k; i++) {
+        if (entries[i].err > max_err) max_err = entries[i].err;
+    }
+    double secs = elapsed_seconds(&t0, &t1);
+    size_t bytes = (size_t)nthreads * (m * (sizeof(HhCounter) + 2 * sizeof(uint32_t)) + slots * sizeof(int32_t));
+    for (int t = 0; t < nthreads; t++) bytes += sketches[t].key_bytes;
+    printf("Heavy hitters: %.1f M records/s (sketch %.2f ms, merge %.2f ms), %.1f MB of sketches, "
+           "top-%zu error <= %zu (bound N/m = %.0f)\n",
+           secs > 0.0 ? (double)lineCount / secs / 1e6 : 0.0, secs * 1000.0,
+           elapsed_seconds(&t1, &t2) * 1000.0, (double)bytes / (1024.0 * 1024.0),
+           k, max_err, (double)lineCount / (double)m);
+    size_t guaranteed = 0;
+    for (size_t i = 0; i < k; i++) {
+        int sure = entries[i].count - entries[i].err >= outside;
+        guaranteed += sure;
+        printf("  %2zu. %.*s  %zu (at least %zu)%s\n", i + 1, (int)entries[i].length, entries[i].key,
+               entries[i].count, entries[i].count - entries[i].err, sure ? "" : "  ?");
+    }
+    printf("  %zu of %zu guaranteed in the top %zu ('?' may be displaced by keys at most %zu)\n",
+           guaranteed, k, args->topk, outside);
 
-        wargs[t] = (WorkerArgs){
-            .start = start,
-            .end = end,
-            .meta = metadata,
-            .out_indices = indices,
-            .out_results = results,
-            .collision_count = &thread_collisions[t],
-            .action = action
-        };
-        pthread_create(&threads[t], NULL, worker, &wargs[t]);
+    char outfile[512];
+    results_path(args, outfile, sizeof(outfile));
+    char *text = NULL;
+    size_t text_len = 0;
+    FILE *out = args->compress_results ? open_memstream(&text, &text_len)
+                                       : fopen(outfile, (op_index == 0) ? "w" : "a");
+    rc = 0;
+    if (!out) {
+        perror("Cannot open results file");
+        rc = 1;
+    } else {
+        // Records are key:count:error, the true count lies in [count - error, count]
+        write_results_header(out, "topk", (t2.tv_sec - t0.tv_sec) * 1000LL + (t2.tv_nsec - t0.tv_nsec) / 1000000LL,
+                             probes);
+        for (size_t i = 0; i < k; i++) {
+            fprintf(out, "%.*s:%zu:%zu%s", (int)entries[i].length, entries[i].key,
+                    entries[i].count, entries[i].err, i + 1 < k ? ", " : "");
+        }
+        fprintf(out, "\n");
+        if (fclose(out) != 0) {
+            perror("Cannot write results file");
+            rc = 1;
+        }
+        if (args->compress_results) {
+            if (rc == 0) rc = write_gzip_members(outfile, (op_index == 0) ? "w" : "a", text, text_len, args->threads);
+            free(text);
+        }
     }
+    if (rc != 0) failed = 1;  // reported above
 
-    // Wait for all threads to complete
-    for (int t = 0; t < nthreads; ++t) {
-        pthread_join(threads[t], NULL);
+out:
+    if (rc != 0 && !failed) perror("Memory allocation failed for heavy hitters");
+    if (sketches) {
+        for (int t = 0; t < nthreads; t++) {
+            if (sketches[t].counters) {
+                for (size_t c = 0; c < m; c++) free(sketches[t].counters[c].key);
+            }
+            free(sketches[t].counters);
+            free(sketches[t].heap);
+            free(sketches[t].heap_pos);
+            free(sketches[t].index);
+        }
+    }
+    free(sketches);
+    free(threads);
+    free(entries);
+    return rc;
+}
+
+// ------------------------------------------------------------------------
+// Background snapshots (snapshot action). Between steps no worker holds a
+// lock, so the process forks and the child writes the table image (one
+// key:slot line per live key, after a # header) to <path>.tmp, fsyncs and
+// renames it, while the parent goes on with the next step. Private pages
+// stay shared copy-on-write; every page either side writes afterwards is
+// duplicated, so the child's private memory at exit is the extra RSS the
+// snapshot cost. The parent pauses only for fork() (page-table copy). The
+// disk engine's table is a MAP_SHARED file mapping that fork() does not
+// copy, so with it the parent waits for the child before the next insert
+// or delete. The child reports through a pipe; it is reaped at step
+// boundaries.
+
+typedef struct {
+    int ok;
+    size_t keys;
+    size_t bytes;
+    double write_ms;
+    size_t private_kb;        // memory private to the child at exit
+} SnapshotResult;
+
+typedef struct {
+    pid_t pid;                // 0 -> no snapshot running
+    int fd;                   // read end of the result pipe
+    char path[512];
+    struct timespec started;
+    long minflt;              // parent minor faults at fork
+} SnapshotJob;
+
+static SnapshotJob g_snapshot;
+
+// Sum of the Private_* fields of /proc/<pid>/smaps_rollup, in kB
+static size_t private_kb(const char *pid) {
+    char file[64], line[256];
+    snprintf(file, sizeof(file), "/proc/%s/smaps_rollup", pid);
+    FILE *f = fopen(file, "r");
+    if (!f) return 0;
+    size_t total = 0, kb;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "Private_Clean: %zu kB", &kb) == 1 || sscanf(line, "Private_Dirty: %zu kB", &kb) == 1) {
+            total += kb;
+        }
     }
+    fclose(f);
+    return total;
+}
 
-    // End timing
+static size_t rss_kb(void) {
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (!f) return 0;
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+    fclose(f);
+    return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE) / 1024;
+}
+
+static long minor_faults(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_minflt;
+}
+
+// Reap a finished snapshot (wait -> block until it is done) and report it
+static void snapshot_poll(int wait) {
+    if (!g_snapshot.pid) return;
+    int status;
+    pid_t done = waitpid(g_snapshot.pid, &status, wait ? 0 : WNOHANG);
+    if (done == 0) return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    SnapshotResult r;
+    memset(&r, 0, sizeof(r));
+    ssize_t got = read(g_snapshot.fd, &r, sizeof(r));
+    close(g_snapshot.fd);
+    long faults = minor_faults() - g_snapshot.minflt;
+
+    if (done < 0 || got != (ssize_t)sizeof(r) || !r.ok || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "Snapshot to %s failed\n", g_snapshot.path);
+    } else {
+        printf("Snapshot %s done: %zu keys, %.1f MB written in %.2f ms (%.2f ms after fork); "
+               "extra RSS %.1f MB copied-on-write, %ld parent minor faults meanwhile\n",
+               g_snapshot.path, r.keys, (double)r.bytes / (1024.0 * 1024.0), r.write_ms,
+               elapsed_seconds(&g_snapshot.started, &now) * 1000.0,
+               (double)r.private_kb / 1024.0, faults);
+    }
+    g_snapshot.pid = 0;
+}
+
+// Key visitor of the snapshot child
+typedef struct {
+    FILE *out;
+    SnapshotResult *result;
+} SnapshotWriter;
+
+static void snapshot_write_key(const char *key, size_t length, size_t slot, void *ctx) {
+    SnapshotWriter *w = (SnapshotWriter *)ctx;
+    int n = fprintf(w->out, "%.*s:%zu\n", (int)length, key, slot);
+    if (n > 0) w->result->bytes += (size_t)n;
+    w->result->keys++;
+}
+
+// Runs in the forked child; never returns
+static void snapshot_child(int fd, const char *path) {
+    SnapshotResult r;
+    memset(&r, 0, sizeof(r));
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    char tmp[600];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *out = fopen(tmp, "w");
+    if (out) {
+        setvbuf(out, NULL, _IOFBF, READ_CHUNK_SIZE);
+        SnapshotWriter w = { out, &r };
+        fprintf(out, "# snapshot engine=%s slots=%zu keys=%zu\n", g_engine->name, g_engine->capacity(), g_live_keys);
+        if (g_engine->capacity() > 0) g_engine->for_each_key(snapshot_write_key, &w);
+        r.ok = fflush(out) == 0 && fsync(fileno(out)) == 0;
+        r.ok &= fclose(out) == 0;
+        r.ok = r.ok && rename(tmp, path) == 0;
+    }
     clock_gettime(CLOCK_MONOTONIC, &t1);
-    long long elapsed_ms = (t1.tv_sec - t0.tv_sec) * 1000LL + (t1.tv_nsec - t0.tv_nsec) / 1000000LL;
+    r.write_ms = elapsed_seconds(&t0, &t1) * 1000.0;
+    r.private_kb = private_kb("self");
 
-    // Sum up collision counts
-    size_t total_collisions = 0;
-    for (int t = 0; t < nthreads; ++t) {
-        total_collisions += thread_collisions[t];
+    ssize_t wrote = write(fd, &r, sizeof(r));
+    _exit(r.ok && wrote == (ssize_t)sizeof(r) ? 0 : 1);
+}
+
+// snapshot action: fork a child that writes the table to path
+static int start_snapshot(const ProgramArgs *args, int op_index, const char *path) {
+    if (g_snapshot.pid) {
+        printf("Waiting for the previous snapshot...\n");
+        snapshot_poll(1);
     }
 
-    // Write results to file
-    write_operation_results(args, op_index, action, lineCount, metadata, 
-                           indices, results, elapsed_ms, total_collisions);
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("Cannot create snapshot pipe");
+        return 1;
+    }
+    fflush(stdout);  // the child must not inherit buffered output
+    fflush(stderr);
+    size_t rss = rss_kb();
 
-    // Cleanup thread resources
-    free(threads);
-    free(wargs);
-    free(thread_collisions);
-    free(indices);
-    free(results);
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    long minflt = minor_faults();
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        snapshot_child(fds[1], path);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    close(fds[1]);
+    if (pid < 0) {
+        perror("Cannot fork snapshot");
+        close(fds[0]);
+        return 1;
+    }
 
-    return 0;
+    g_snapshot.pid = pid;
+    g_snapshot.fd = fds[0];
+    g_snapshot.started = t1;
+    g_snapshot.minflt = minflt;
+    snprintf(g_snapshot.path, sizeof(g_snapshot.path), "%s", path);
+
+    double pause_ms = elapsed_seconds(&t0, &t1) * 1000.0;
+    printf("Snapshot forked (pid %d): parent paused %.3f ms with %.1f MB resident, %zu live keys\n",
+           (int)pid, pause_ms, (double)rss / 1024.0, g_live_keys);
+    return write_operation_results(args, op_index, "snapshot", 0, NULL, NULL, NULL, (long long)pause_ms, 0);
 }
 
 int run_app(const ProgramArgs *args) {
+    g_engine = find_engine(args->engine);
+    if (select_kernels(args->isa) != 0) return 1;
+    printf("Kernels: %s (hash fnv1a64 scalar)\n", g_kernels.isa);
+    g_filter_fpr = args->fpr;
+    g_hot_entries = 0;
+    if (args->hot_cache) {
+        g_hot_entries = 1;
+        while (g_hot_entries < args->hot_cache) g_hot_entries <<= 1;
+    }
+    char disk_path[600];
+    if (!args->disk_file) snprintf(disk_path, sizeof(disk_path), "%s/disk_table.bin", args->results_dir);
+    g_disk_path = args->disk_file ? args->disk_file : disk_path;
+    g_disk_unlink = args->disk_file == NULL;
+    if (args->profile_file && prof_start(args->profile_hz) != 0) return 1;
+    if (args->calibrate && calibrate_machine(args) != 0) return 1;
+
     for (int i = 0; i < args->num_operations; ++i) {
+        snapshot_poll(0);
+        g_step_scan = "none";
+        if (strcmp(args->action[i], "freeze") == 0) {
+            printf(">>> Action: freeze\n");
+            if (freeze_table(args, i) != 0) return 1;
+            continue;
+        }
+        if (strcmp(args->action[i], "snapshot") == 0) {
+            printf(">>> Action: snapshot to %s\n", args->input_files[i]);
+            if (start_snapshot(args, i, args->input_files[i]) != 0) return 1;
+            continue;
+        }
+        if (is_set_action(args->action[i])) {
+            printf(">>> Action: %s on tables: %s\n", args->action[i], args->input_files[i]);
+            if (set_operation(args, i, args->action[i], args->input_files[i]) != 0) return 1;
+            continue;
+        }
         printf(">>> Action: %s on file: %s\n", args->action[i], args->input_files[i]);
+        if (strcmp(args->action[i], "topk") == 0) {
+            // Streamed from the file, the dataset cache is not involved
+            g_step_scan = g_kernels.scan_name;
+            if (heavy_hitters(args, i, args->input_files[i]) != 0) return 1;
+            continue;
+        }
 
-        size_t lineCount = 0, totalDataSize = 0;
-        if (preprocess(args->input_files[i], &lineCount, &totalDataSize) != 0) return 1;
+        Dataset transient;
+        Dataset *ds = acquire_dataset(args, args->input_files[i], &transient);
+        if (!ds) return 1;
 
+        size_t lineCount = ds->lineCount;
+        StringMetadata *metadata = ds->metadata;
         if (lineCount == 0) {
             printf("File %s is empty.\n", args->input_files[i]);
+            release_dataset(ds);
             continue;
         }
 
-        StringMetadata *metadata = NULL;
-        char *data = NULL;
+        g_step_key_source = args->zero_copy ? share_dataset(ds) : 0;
 
-        if (allocate_memory(lineCount, totalDataSize, &metadata, &data) != 0) return 1;
-        if (read_data(args->input_files[i], lineCount, metadata, data) != 0) {
-            free(metadata);
-            free(data);
-            return 1;
+        if (g_snapshot.pid && g_engine->shared_table && (strcmp(args->action[i], "insert") == 0 ||
+                                                          strcmp(args->action[i], "delete") == 0)) {
+            printf("Waiting for the snapshot: the %s table is not copy-on-write\n", g_engine->name);
+            snapshot_poll(1);
         }
+        if (g_frozen.valid && (strcmp(args->action[i], "insert") == 0 ||
+                               strcmp(args->action[i], "delete") == 0)) {
+            printf("Dropping frozen index: the table changes\n");
+            frozen_release();
+        }
+
         if (strcmp(args->action[i], "insert") == 0) {
-            if (execute_hash_operation(args, i, "insert", lineCount, metadata) != 0) {
-                free(metadata);
-                free(data);
+            if (presize_table(args, lineCount, metadata) != 0 ||
+                maybe_grow_table(args, lineCount) != 0 ||
+                execute_hash_operation(args, i, "insert", lineCount, metadata) != 0) {
+                release_dataset(ds);
                 return 1;
             }
         } else if (strcmp(args->action[i], "delete") == 0) {
             if (execute_hash_operation(args, i, "delete", lineCount, metadata) != 0) {
-                free(metadata);
-                free(data);
+                release_dataset(ds);
+                return 1;
+            }
+        } else if (strcmp(args->action[i], "lookup") == 0) {
+            if (lookup_operation(args, i, lineCount, metadata) != 0) {
+                release_dataset(ds);
                 return 1;
             }
         } else {
             fprintf(stderr, "Unknown action: %s\n", args->action[i]);
         }
 
-        free(metadata);
-        free(data);
+        release_dataset(ds);
+        g_step_key_source = 0;
+
+        if (strcmp(args->action[i], "delete") == 0 && maybe_shrink_table(args) != 0) return 1;
+        if (args->zero_copy && compact_key_sources() != 0) return 1;
+        if (args->analyze && analyze_table(args->action[i], i) != 0) return 1;
     }
 
     // Cleanup global resources
-    cleanup_table_and_locks();
+    snapshot_poll(1);
+    frozen_release();
+    release_set_tables();
+    g_engine->cleanup();
+    cleanup_dataset_cache();
+    release_key_sources();
+    pool_release_all();
 
+    if (args->profile_file && prof_finish(args->profile_file) != 0) return 1;
     return 0;
 }
 
+#ifndef HW2_NO_MAIN
 int main(int argc, char *argv[]) {
     ProgramArgs args;
     if (parse_arguments(argc, argv, &args) != 0) {
@@ -600,3 +6274,4 @@ int main(int argc, char *argv[]) {
 
     return run_app(&args);
 }
+#endif
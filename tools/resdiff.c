@@ -0,0 +1,464 @@
+// Parallel diff for HW2 results files.
+//
+// Both files are mmapped and walked section by section ("Actions:" header
+// lines followed by one record line). Each record line is split into records
+// in parallel (count, prefix-sum, index), and records are then compared in
+// parallel index ranges. ExecutionTime is never compared.
+//
+//   exact mode (default): records must be byte-identical and collision
+//                         counts must match
+//   --keys:               only key and T/F result are compared, slot
+//                         indices are ignored
+//
+// Usage: resdiff [--keys] [--threads N] [--max N] <fileA> <fileB>
+// Exit status: 0 equivalent, 1 different, 2 error.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define DEFAULT_MAX_REPORTED 10
+
+typedef struct {
+    const char *path;
+    const char *data;
+    size_t size;
+} MappedFile;
+
+// One record line split into records
+typedef struct {
+    const char *line;
+    size_t length;
+    size_t *offsets;   // start offset of every record within line
+    size_t count;
+} RecordLine;
+
+typedef struct {
+    int keys_only;
+    int threads;
+    size_t max_reported;
+} DiffOptions;
+
+// ------------------------------------------------------------------------
+// Mapping
+
+static int map_file(const char *path, MappedFile *f) {
+    f->path = path;
+    f->data = NULL;
+    f->size = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+
+    f->size = (size_t)st.st_size;
+    if (f->size > 0) {
+        void *p = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if (p == MAP_FAILED) {
+            perror(path);
+            close(fd);
+            return -1;
+        }
+        madvise(p, f->size, MADV_SEQUENTIAL);
+        f->data = (const char *)p;
+    }
+    close(fd);
+    return 0;
+}
+
+static void unmap_file(MappedFile *f) {
+    if (f->data) munmap((void *)f->data, f->size);
+    f->data = NULL;
+}
+
+// ------------------------------------------------------------------------
+// Parallel record splitting. Records are separated by ',' optionally
+// followed by one space (src/main.c writes ", ", main_updated.c ",").
+
+typedef struct {
+    const RecordLine *rl;
+    size_t begin, end;   // byte range of this chunk
+    size_t count;        // records starting inside [begin, end)
+    size_t first_index; // global index of the first of them
+    int fill;            // 0 -> count only, 1 -> write offsets
+} SplitTask;
+
+static void *split_worker(void *arg) {
+    SplitTask *task = (SplitTask *)arg;
+    const char *line = task->rl->line;
+    size_t count = 0;
+
+    // Record 0 starts at offset 0; every other record starts after a ','
+    size_t pos = task->begin;
+    if (pos == 0 && task->rl->length > 0) {
+        if (task->fill) task->rl->offsets[task->first_index] = 0;
+        count++;
+    }
+    while (pos < task->end) {
+        const char *comma = memchr(line + pos, ',', task->end - pos);
+        if (!comma) break;
+        size_t start = (size_t)(comma - line) + 1;
+        if (start < task->rl->length && line[start] == ' ') start++;
+        if (task->fill) task->rl->offsets[task->first_index + count] = start;
+        count++;
+        pos = (size_t)(comma - line) + 1;
+    }
+
+    task->count = count;
+    return NULL;
+}
+
+static void run_tasks(void *(*fn)(void *), void *tasks, size_t task_size, int n) {
+    pthread_t *threads = (pthread_t *)malloc(n * sizeof(pthread_t));
+    if (!threads) {
+        for (int t = 0; t < n; t++) fn((char *)tasks + t * task_size);
+        return;
+    }
+    for (int t = 0; t < n; t++) {
+        if (pthread_create(&threads[t], NULL, fn, (char *)tasks + t * task_size) != 0) {
+            fn((char *)tasks + t * task_size);
+            threads[t] = 0;
+        }
+    }
+    for (int t = 0; t < n; t++) {
+        if (threads[t]) pthread_join(threads[t], NULL);
+    }
+    free(threads);
+}
+
+static int split_records(RecordLine *rl, int nthreads) {
+    SplitTask *tasks = (SplitTask *)calloc(nthreads, sizeof(SplitTask));
+    if (!tasks) {
+        perror("Memory allocation failed");
+        return -1;
+    }
+
+    size_t chunk = (rl->length + nthreads - 1) / nthreads;
+    for (int t = 0; t < nthreads; t++) {
+        tasks[t].rl = rl;
+        tasks[t].begin = t * chunk < rl->length ? t * chunk : rl->length;
+        tasks[t].end = tasks[t].begin + chunk < rl->length ? tasks[t].begin + chunk : rl->length;
+    }
+
+    run_tasks(split_worker, tasks, sizeof(SplitTask), nthreads);
+
+    rl->count = 0;
+    for (int t = 0; t < nthreads; t++) {
+        tasks[t].first_index = rl->count;
+        tasks[t].fill = 1;
+        rl->count += tasks[t].count;
+    }
+
+    rl->offsets = (size_t *)malloc((rl->count + 1) * sizeof(size_t));
+    if (!rl->offsets) {
+        perror("Memory allocation failed");
+        free(tasks);
+        return -1;
+    }
+    run_tasks(split_worker, tasks, sizeof(SplitTask), nthreads);
+    free(tasks);
+    return 0;
+}
+
+// Record i as [ptr, ptr + len) without the trailing separator
+static const char *record_at(const RecordLine *rl, size_t i, size_t *len) {
+    size_t start = rl->offsets[i];
+    size_t end = (i + 1 < rl->count) ? rl->offsets[i + 1] : rl->length;
+    while (end > start && (rl->line[end - 1] == ' ' || rl->line[end - 1] == ',')) end--;
+    *len = end - start;
+    return rl->line + start;
+}
+
+// ------------------------------------------------------------------------
+// Parallel comparison
+
+typedef struct {
+    const RecordLine *a, *b;
+    const DiffOptions *opts;
+    size_t begin, end;        // record index range
+    size_t mismatches;
+    size_t *first;            // first opts->max_reported mismatching indices
+    size_t nfirst;
+} CompareTask;
+
+static int records_equal(const char *ra, size_t la, const char *rb, size_t lb, int keys_only) {
+    if (!keys_only) return la == lb && memcmp(ra, rb, la) == 0;
+
+    const char *ka = memchr(ra, ':', la);
+    const char *kb = memchr(rb, ':', lb);
+    size_t kla = ka ? (size_t)(ka - ra) : la;
+    size_t klb = kb ? (size_t)(kb - rb) : lb;
+    if (kla != klb || memcmp(ra, rb, kla) != 0) return 0;
+    if (la == 0 || lb == 0) return la == lb;
+    return ra[la - 1] == rb[lb - 1];  // T/F outcome
+}
+
+static void *compare_worker(void *arg) {
+    CompareTask *task = (CompareTask *)arg;
+    for (size_t i = task->begin; i < task->end; i++) {
+        size_t la, lb;
+        const char *ra = record_at(task->a, i, &la);
+        const char *rb = record_at(task->b, i, &lb);
+        if (!records_equal(ra, la, rb, lb, task->opts->keys_only)) {
+            if (task->nfirst < task->opts->max_reported) task->first[task->nfirst++] = i;
+            task->mismatches++;
+        }
+    }
+    return NULL;
+}
+
+// Compare two split record lines; prints the first mismatches, returns count
+static size_t compare_records(const RecordLine *a, const RecordLine *b, const DiffOptions *opts,
+                              int section) {
+    size_t n = a->count < b->count ? a->count : b->count;
+    size_t mismatches = 0;
+
+    if (n > 0) {
+        int nthreads = opts->threads;
+        if ((size_t)nthreads > n) nthreads = (int)n;
+
+        CompareTask *tasks = (CompareTask *)calloc(nthreads, sizeof(CompareTask));
+        size_t *first = (size_t *)malloc((size_t)nthreads * (opts->max_reported + 1) * sizeof(size_t));
+        if (!tasks || !first) {
+            perror("Memory allocation failed");
+            free(tasks);
+            free(first);
+            return (size_t)-1;
+        }
+
+        size_t chunk = (n + nthreads - 1) / nthreads;
+        for (int t = 0; t < nthreads; t++) {
+            tasks[t].a = a;
+            tasks[t].b = b;
+            tasks[t].opts = opts;
+            tasks[t].begin = t * chunk < n ? t * chunk : n;
+            tasks[t].end = tasks[t].begin + chunk < n ? tasks[t].begin + chunk : n;
+            tasks[t].first = first + (size_t)t * (opts->max_reported + 1);
+        }
+
+        run_tasks(compare_worker, tasks, sizeof(CompareTask), nthreads);
+
+        size_t reported = 0;
+        for (int t = 0; t < nthreads; t++) {
+            for (size_t k = 0; k < tasks[t].nfirst && reported < opts->max_reported; k++, reported++) {
+                size_t i = tasks[t].first[k], la, lb;
+                const char *ra = record_at(a, i, &la);
+                const char *rb = record_at(b, i, &lb);
+                printf("section %d record %zu:\n  < %.*s\n  > %.*s\n",
+                       section, i, (int)la, ra, (int)lb, rb);
+            }
+            mismatches += tasks[t].mismatches;
+        }
+
+        free(tasks);
+        free(first);
+    }
+
+    if (a->count != b->count) {
+        printf("section %d: record count differs (%zu vs %zu)\n", section, a->count, b->count);
+        mismatches += (a->count > b->count ? a->count - b->count : b->count - a->count);
+    }
+    return mismatches;
+}
+
+// ------------------------------------------------------------------------
+// Section walking
+
+typedef struct {
+    const char *p, *end;
+} Cursor;
+
+// Next line without its '\n'; returns 0 at end of file
+static int next_line(Cursor *c, const char **line, size_t *len) {
+    if (c->p >= c->end) return 0;
+    const char *nl = memchr(c->p, '\n', (size_t)(c->end - c->p));
+    const char *stop = nl ? nl : c->end;
+    *line = c->p;
+    *len = (size_t)(stop - c->p);
+    c->p = nl ? nl + 1 : c->end;
+    return 1;
+}
+
+// Header lines look like "Name: value" (first ':' followed by a space)
+static int is_header(const char *line, size_t len) {
+    const char *colon = memchr(line, ':', len);
+    return colon && colon + 1 < line + len && colon[1] == ' ';
+}
+
+static int starts_with(const char *line, size_t len, const char *prefix) {
+    size_t n = strlen(prefix);
+    return len >= n && memcmp(line, prefix, n) == 0;
+}
+
+typedef struct {
+    const char *action; size_t action_len;
+    const char *collisions; size_t collisions_len;
+    RecordLine records;
+    int found;
+} Section;
+
+// Parse the next section: skip to "Actions:", read headers, take record line
+static int next_section(Cursor *c, Section *s) {
+    const char *line;
+    size_t len;
+    memset(s, 0, sizeof(*s));
+
+    while (next_line(c, &line, &len)) {
+        if (starts_with(line, len, "Actions: ")) {
+            s->action = line + 9;
+            s->action_len = len - 9;
+            s->found = 1;
+            break;
+        }
+    }
+    if (!s->found) return 0;
+
+    while (next_line(c, &line, &len)) {
+        if (starts_with(line, len, "Actions: ")) {
+            // Section without records; rewind so the caller sees it next
+            c->p = line;
+            return 1;
+        }
+        if (is_header(line, len)) {
+            if (starts_with(line, len, "NumberOfHandledCollision: ")) {
+                s->collisions = line + 26;
+                s->collisions_len = len - 26;
+            }
+            continue;
+        }
+        s->records.line = line;
+        s->records.length = len;
+        break;
+    }
+    return 1;
+}
+
+static int parse_diff_arguments(int argc, char *argv[], DiffOptions *opts, const char **a, const char **b) {
+    opts->keys_only = 0;
+    opts->threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    opts->max_reported = DEFAULT_MAX_REPORTED;
+    *a = *b = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--keys") == 0) {
+            opts->keys_only = 1;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            opts->threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max") == 0 && i + 1 < argc) {
+            opts->max_reported = (size_t)strtoull(argv[++i], NULL, 10);
+        } else if (argv[i][0] != '-' && !*a) {
+            *a = argv[i];
+        } else if (argv[i][0] != '-' && !*b) {
+            *b = argv[i];
+        } else {
+            fprintf(stderr, "Error: Unknown or misplaced argument '%s'\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (!*a || !*b) {
+        fprintf(stderr, "Usage: resdiff [--keys] [--threads N] [--max N] <fileA> <fileB>\n");
+        return 1;
+    }
+    if (opts->threads < 1) opts->threads = 1;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    DiffOptions opts;
+    const char *path_a, *path_b;
+    if (parse_diff_arguments(argc, argv, &opts, &path_a, &path_b) != 0) return 2;
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    MappedFile fa, fb;
+    if (map_file(path_a, &fa) != 0) return 2;
+    if (map_file(path_b, &fb) != 0) {
+        unmap_file(&fa);
+        return 2;
+    }
+
+    Cursor ca = { fa.data, fa.data + fa.size };
+    Cursor cb = { fb.data, fb.data + fb.size };
+    size_t total_records = 0, total_mismatches = 0;
+    int section = 0, status = 0;
+
+    while (1) {
+        Section sa, sb;
+        int has_a = fa.data ? next_section(&ca, &sa) : 0;
+        int has_b = fb.data ? next_section(&cb, &sb) : 0;
+        if (!has_a && !has_b) break;
+        if (has_a != has_b) {
+            printf("section %d: only in %s\n", section, has_a ? path_a : path_b);
+            total_mismatches++;
+            break;
+        }
+
+        if (sa.action_len != sb.action_len || memcmp(sa.action, sb.action, sa.action_len) != 0) {
+            printf("section %d: action differs (%.*s vs %.*s)\n", section,
+                   (int)sa.action_len, sa.action, (int)sb.action_len, sb.action);
+            total_mismatches++;
+        }
+        if (!opts.keys_only && (sa.collisions_len != sb.collisions_len ||
+                                memcmp(sa.collisions, sb.collisions, sa.collisions_len) != 0)) {
+            printf("section %d: collisions differ (%.*s vs %.*s)\n", section,
+                   (int)sa.collisions_len, sa.collisions, (int)sb.collisions_len, sb.collisions);
+            total_mismatches++;
+        }
+
+        if (split_records(&sa.records, opts.threads) != 0 ||
+            split_records(&sb.records, opts.threads) != 0) {
+            free(sa.records.offsets);
+            free(sb.records.offsets);
+            status = 2;
+            break;
+        }
+
+        size_t mismatches = compare_records(&sa.records, &sb.records, &opts, section);
+        if (mismatches == (size_t)-1) {
+            status = 2;
+        } else {
+            total_mismatches += mismatches;
+            if (mismatches) {
+                printf("section %d (%.*s): %zu of %zu records differ\n", section,
+                       (int)sa.action_len, sa.action, mismatches, sa.records.count);
+            }
+        }
+        total_records += sa.records.count;
+
+        free(sa.records.offsets);
+        free(sb.records.offsets);
+        if (status) break;
+        section++;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+    fprintf(stderr, "%d sections, %zu records, %zu mismatches (%s mode) in %.3fs, %.1f MB/s\n",
+            section, total_records, total_mismatches, opts.keys_only ? "keys" : "exact", secs,
+            secs > 0 ? (double)(fa.size + fb.size) / secs / 1e6 : 0.0);
+
+    unmap_file(&fa);
+    unmap_file(&fb);
+
+    if (status) return status;
+    return total_mismatches ? 1 : 0;
+}
@@ -0,0 +1,467 @@
+// Differential stress tester for the concurrent hash engines.
+//
+// Runs randomised insert/delete workloads through every engine registered in
+// g_engines at several thread counts and checks each step against a serial
+// oracle (hash_insert/hash_delete from main_updated.c):
+//   - per key, the number of T outcomes matches the serial run (every
+//     serialisable interleaving of same-action operations gives the same count)
+//   - every insert of a key reports the slot the key actually lives in
+//   - the final key set matches the oracle, with no lost or duplicated keys,
+//     including across between-step table rebuilds
+// Approximate engines (filters) cannot list their keys; they get a filter
+// round instead: after inserting half of the pool every member must look up
+// "T" (no false negatives), lookups must not change the filter, and the
+// other half must read "T" no more often than the engine's false-positive
+// rate allows. A watchdog aborts the run if a step hangs.
+//
+// Usage: stress [--engine <name>] [--rounds N] [--steps N] [--ops N]
+//               [--keys N] [--seed N] [--timeout SECONDS]
+
+#define HW2_NO_MAIN
+#include "../src/main.c"
+
+#include <signal.h>
+#include <unistd.h>
+
+#define KEY_LENGTH 12
+#define MAX_REPORTED_ERRORS 10
+
+static const int stress_threads[] = { 1, 2, 3, 4, 8, 16, 64 };
+#define NUM_STRESS_THREADS (sizeof(stress_threads) / sizeof(stress_threads[0]))
+
+typedef struct {
+    const char *engine;   // NULL -> all engines
+    int rounds;
+    int steps;
+    size_t ops;
+    size_t keys;
+    uint64_t seed;
+    unsigned timeout;
+} StressArgs;
+
+// ------------------------------------------------------------------------
+// Serial oracle, adapted from hash_insert/hash_delete in main_updated.c
+
+typedef struct {
+    char *key;
+    uint8_t tombstone;
+} OracleEntry;
+
+static OracleEntry *o_table = NULL;
+static size_t o_table_size = 0;
+
+static int oracle_insert(const char *key, size_t len) {
+    size_t pos = fnv1a64(key, len) % o_table_size;
+    size_t first_tombstone = (size_t)(-1);
+
+    while (1) {
+        OracleEntry *e = &o_table[pos];
+        if (e->key == NULL) {
+            if (e->tombstone) {
+                if (first_tombstone == (size_t)(-1)) first_tombstone = pos;
+            } else {
+                size_t target = (first_tombstone == (size_t)(-1)) ? pos : first_tombstone;
+                o_table[target].key = (char *)malloc(len + 1);
+                memcpy(o_table[target].key, key, len + 1);
+                o_table[target].tombstone = 0;
+                return 0;
+            }
+        } else if (strlen(e->key) == len && memcmp(e->key, key, len) == 0) {
+            return 1;
+        }
+        pos = (pos + 1) % o_table_size;
+    }
+}
+
+static int oracle_delete(const char *key, size_t len) {
+    size_t pos = fnv1a64(key, len) % o_table_size;
+
+    while (1) {
+        OracleEntry *e = &o_table[pos];
+        if (e->key == NULL) {
+            if (!e->tombstone) return 0;
+        } else if (strlen(e->key) == len && memcmp(e->key, key, len) == 0) {
+            free(e->key);
+            e->key = NULL;
+            e->tombstone = 1;
+            return 1;
+        }
+        pos = (pos + 1) % o_table_size;
+    }
+}
+
+static void oracle_reset(size_t size) {
+    if (o_table) {
+        for (size_t i = 0; i < o_table_size; i++) free(o_table[i].key);
+        free(o_table);
+    }
+    o_table_size = size;
+    o_table = size ? (OracleEntry *)calloc(size, sizeof(OracleEntry)) : NULL;
+}
+
+// ------------------------------------------------------------------------
+// Workload generation
+
+static uint64_t rng_state;
+
+static uint64_t rng_next(void) {
+    // xorshift64*
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+// Key i is "<4 random hex><8 hex digits of i>" so engine keys map back to ids
+static char *make_key_pool(size_t keys) {
+    char *pool = (char *)malloc(keys * (KEY_LENGTH + 1));
+    if (!pool) return NULL;
+    for (size_t i = 0; i < keys; i++) {
+        snprintf(pool + i * (KEY_LENGTH + 1), KEY_LENGTH + 1, "%04x%08x",
+                 (unsigned)(rng_next() & 0xffff), (unsigned)i);
+    }
+    return pool;
+}
+
+static size_t key_id(const char *key) {
+    return (size_t)strtoull(key + 4, NULL, 16);
+}
+
+// Half of the operations hit a small hot set so threads contend on keys
+static size_t pick_key(size_t keys) {
+    size_t hot = keys / 32 + 1;
+    if (rng_next() & 1) return rng_next() % hot;
+    return rng_next() % keys;
+}
+
+// ------------------------------------------------------------------------
+// Invariant checking
+
+typedef struct {
+    size_t *slot;       // per key id: engine slot, (size_t)-1 if absent
+    size_t *seen;       // per key id: times enumerated
+    size_t keys;
+    size_t foreign;     // enumerated keys that are not in the pool
+} KeySnapshot;
+
+static void snapshot_visit(const char *key, size_t length, size_t slot, void *ctx) {
+    KeySnapshot *snap = (KeySnapshot *)ctx;
+    size_t id = key_id(key);
+    if (length != KEY_LENGTH || id >= snap->keys) {
+        snap->foreign++;
+        return;
+    }
+    snap->slot[id] = slot;
+    snap->seen[id]++;
+}
+
+static void take_snapshot(KeySnapshot *snap) {
+    for (size_t i = 0; i < snap->keys; i++) {
+        snap->slot[i] = (size_t)(-1);
+        snap->seen[i] = 0;
+    }
+    snap->foreign = 0;
+    g_engine->for_each_key(snapshot_visit, snap);
+}
+
+static size_t g_errors = 0;
+
+#define STRESS_FAIL(...) do {                                   \
+        if (g_errors++ < MAX_REPORTED_ERRORS) {                 \
+            fprintf(stderr, "  FAIL: " __VA_ARGS__);            \
+            fputc('\n', stderr);                                \
+        }                                                       \
+    } while (0)
+
+// Run one randomised flow on the current engine and check every step
+static void stress_round(const StressArgs *sa, int nthreads, size_t tsize, const char *pool,
+                         StringMetadata *meta, size_t *ids, size_t *indices, char *results,
+                         size_t *oracle_t, size_t *engine_t, size_t *insert_slot,
+                         KeySnapshot *before, KeySnapshot *after) {
+    ProgramArgs args;
+    memset(&args, 0, sizeof(args));
+    args.threads = nthreads;
+    args.tsize = tsize;
+    args.num_operations = sa->steps;
+
+    if (g_engine->ensure(tsize) != 0) {
+        STRESS_FAIL("engine %s could not allocate %zu slots", g_engine->name, tsize);
+        return;
+    }
+    oracle_reset(tsize);
+
+    for (int step = 0; step < sa->steps; step++) {
+        const char *action = (rng_next() % 5 < 3) ? "insert" : "delete";
+        int is_insert = strcmp(action, "insert") == 0;
+
+        for (size_t j = 0; j < sa->ops; j++) {
+            ids[j] = pick_key(sa->keys);
+            meta[j].ptr = (char *)pool + ids[j] * (KEY_LENGTH + 1);
+            meta[j].length = KEY_LENGTH;
+        }
+
+        take_snapshot(before);
+
+        long long elapsed_ms;
+        size_t collisions;
+        if (run_hash_step(&args, step, action, sa->ops, meta, indices, results,
+                          &elapsed_ms, &collisions) != 0) {
+            STRESS_FAIL("run_hash_step failed");
+            return;
+        }
+
+        memset(oracle_t, 0, sa->keys * sizeof(size_t));
+        memset(engine_t, 0, sa->keys * sizeof(size_t));
+        for (size_t i = 0; i < sa->keys; i++) insert_slot[i] = (size_t)(-1);
+
+        for (size_t j = 0; j < sa->ops; j++) {
+            int hit = is_insert ? oracle_insert(meta[j].ptr, meta[j].length)
+                                : oracle_delete(meta[j].ptr, meta[j].length);
+            oracle_t[ids[j]] += hit;
+
+            if (results[j] != 'T' && results[j] != 'F') {
+                STRESS_FAIL("%s step %d: op %zu reported '%c'", action, step, j, results[j]);
+                continue;
+            }
+            engine_t[ids[j]] += (results[j] == 'T');
+        }
+
+        take_snapshot(after);
+
+        for (size_t j = 0; j < sa->ops; j++) {
+            size_t id = ids[j];
+            if (is_insert) {
+                if (insert_slot[id] == (size_t)(-1)) insert_slot[id] = indices[j];
+                if (indices[j] != insert_slot[id] || indices[j] != after->slot[id]) {
+                    STRESS_FAIL("insert step %d: key %s reported slot %zu, lives in %zu",
+                                step, meta[j].ptr, indices[j], after->slot[id]);
+                }
+            } else if (results[j] == 'T' && indices[j] != before->slot[id]) {
+                STRESS_FAIL("delete step %d: key %s reported slot %zu, lived in %zu",
+                            step, meta[j].ptr, indices[j], before->slot[id]);
+            }
+        }
+
+        for (size_t id = 0; id < sa->keys; id++) {
+            if (engine_t[id] != oracle_t[id]) {
+                STRESS_FAIL("%s step %d: key %s got %zu T outcomes, oracle %zu",
+                            action, step, pool + id * (KEY_LENGTH + 1), engine_t[id], oracle_t[id]);
+            }
+        }
+
+        // Final key set of the step: exactly the oracle's, each key once
+        size_t o_live = 0;
+        for (size_t i = 0; i < o_table_size; i++) {
+            if (!o_table[i].key) continue;
+            o_live++;
+            size_t id = key_id(o_table[i].key);
+            if (after->seen[id] == 0) {
+                STRESS_FAIL("%s step %d: key %s lost", action, step, o_table[i].key);
+            }
+        }
+        size_t e_live = 0;
+        for (size_t id = 0; id < sa->keys; id++) {
+            e_live += after->seen[id];
+            if (after->seen[id] > 1) {
+                STRESS_FAIL("%s step %d: key %s stored %zu times", action, step,
+                            pool + id * (KEY_LENGTH + 1), after->seen[id]);
+            }
+        }
+        if (after->foreign) {
+            STRESS_FAIL("%s step %d: %zu corrupted keys in table", action, step, after->foreign);
+        }
+        if (e_live != o_live) {
+            STRESS_FAIL("%s step %d: engine holds %zu keys, oracle %zu", action, step, e_live, o_live);
+        }
+        if (g_live_keys != o_live) {
+            STRESS_FAIL("%s step %d: live-key counter %zu, oracle %zu", action, step, g_live_keys, o_live);
+        }
+
+        // Exercise the between-step rebuild; the table must still fit every pool key
+        if (!is_insert && g_engine->resize && (rng_next() & 1)) {
+            size_t new_size = (rng_next() & 1) ? sa->keys * 2 : sa->keys + sa->keys / 8 + 1;
+            if (g_engine->resize(new_size, nthreads) != 0 || g_engine->capacity() != new_size) {
+                STRESS_FAIL("resize to %zu slots failed", new_size);
+            }
+        }
+    }
+
+    g_engine->cleanup();
+}
+
+// Filter round for an approximate engine: members are the first half of
+// the pool, the second half is never inserted
+static void filter_round(const StressArgs *sa, int nthreads, size_t tsize, const char *pool,
+                         StringMetadata *meta, size_t *indices, char *results) {
+    ProgramArgs args;
+    memset(&args, 0, sizeof(args));
+    args.threads = nthreads;
+    args.tsize = tsize;
+
+    if (g_engine->ensure(tsize) != 0) {
+        STRESS_FAIL("engine %s could not allocate %zu slots", g_engine->name, tsize);
+        return;
+    }
+
+    size_t members = sa->keys / 2, absent = sa->keys - members;
+    for (size_t j = 0; j < sa->keys; j++) {
+        meta[j].ptr = (char *)pool + j * (KEY_LENGTH + 1);
+        meta[j].length = KEY_LENGTH;
+    }
+
+    long long elapsed_ms;
+    size_t collisions;
+    if (run_hash_step(&args, 0, "insert", members, meta, indices, results, &elapsed_ms, &collisions) != 0) {
+        STRESS_FAIL("run_hash_step failed");
+        return;
+    }
+    size_t live = g_live_keys;
+
+    if (run_hash_step(&args, 1, "lookup", sa->keys, meta, indices, results, &elapsed_ms, &collisions) != 0) {
+        STRESS_FAIL("run_hash_step failed");
+        return;
+    }
+    size_t false_positives = 0;
+    for (size_t j = 0; j < sa->keys; j++) {
+        if (results[j] != 'T' && results[j] != 'F') {
+            STRESS_FAIL("lookup: op %zu reported '%c'", j, results[j]);
+        } else if (j < members && results[j] != 'T') {
+            STRESS_FAIL("lookup: inserted key %s reported absent", meta[j].ptr);
+        } else if (j >= members) {
+            false_positives += results[j] == 'T';
+        }
+    }
+    if (g_live_keys != live) {
+        STRESS_FAIL("lookup changed the filter: %zu keys before, %zu after", live, g_live_keys);
+    }
+
+    // Generous binomial bound over the configured rate
+    double expected = g_filter_fpr * (double)absent;
+    if ((double)false_positives > 3.0 * expected + 10.0) {
+        STRESS_FAIL("lookup: %zu false positives among %zu absent keys, expected about %.1f",
+                    false_positives, absent, expected);
+    }
+
+    g_engine->cleanup();
+}
+
+static void on_timeout(int sig) {
+    (void)sig;
+    static const char msg[] = "FAIL: step did not finish before the watchdog timeout (hang)\n";
+    ssize_t rc = write(STDERR_FILENO, msg, sizeof(msg) - 1);
+    (void)rc;
+    _exit(2);
+}
+
+static int parse_stress_arguments(int argc, char *argv[], StressArgs *sa) {
+    *sa = (StressArgs){ NULL, 3, 8, 5000, 2000, 0x9e3779b97f4a7c15ULL, 60 };
+
+    for (int i = 1; i < argc; i += 2) {
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Error: Missing value for '%s'\n", argv[i]);
+            return 1;
+        }
+        if (strcmp(argv[i], "--engine") == 0) {
+            sa->engine = argv[i + 1];
+            if (!find_engine(sa->engine)) {
+                fprintf(stderr, "Error: Unknown engine '%s'\n", sa->engine);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--rounds") == 0) {
+            sa->rounds = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--steps") == 0) {
+            sa->steps = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "--ops") == 0) {
+            sa->ops = parse_size(argv[i + 1]);
+        } else if (strcmp(argv[i], "--keys") == 0) {
+            sa->keys = parse_size(argv[i + 1]);
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            sa->seed = strtoull(argv[i + 1], NULL, 0);
+        } else if (strcmp(argv[i], "--timeout") == 0) {
+            sa->timeout = (unsigned)atoi(argv[i + 1]);
+        } else {
+            fprintf(stderr, "Error: Unknown argument '%s'\n", argv[i]);
+            return 1;
+        }
+    }
+
+    if (sa->rounds < 1 || sa->steps < 1 || sa->ops == 0 || sa->keys == 0 || sa->seed == 0) {
+        fprintf(stderr, "Error: --rounds, --steps, --ops, --keys and --seed must be positive\n");
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    StressArgs sa;
+    if (parse_stress_arguments(argc, argv, &sa) != 0) return 1;
+
+    rng_state = sa.seed;
+    char *pool = make_key_pool(sa.keys);
+    size_t batch = sa.ops > sa.keys ? sa.ops : sa.keys;  // filter rounds look up the whole pool
+    StringMetadata *meta = (StringMetadata *)malloc(batch * sizeof(StringMetadata));
+    size_t *ids = (size_t *)malloc(sa.ops * sizeof(size_t));
+    size_t *indices = (size_t *)malloc(batch * sizeof(size_t));
+    char *results = (char *)malloc(batch);
+    size_t *per_key = (size_t *)malloc(7 * sa.keys * sizeof(size_t));
+    if (!pool || !meta || !ids || !indices || !results || !per_key) {
+        perror("Memory allocation failed");
+        return 1;
+    }
+    size_t *oracle_t = per_key;
+    size_t *engine_t = per_key + sa.keys;
+    size_t *insert_slot = per_key + 2 * sa.keys;
+    KeySnapshot before = { per_key + 3 * sa.keys, per_key + 4 * sa.keys, sa.keys, 0 };
+    KeySnapshot after = { per_key + 5 * sa.keys, per_key + 6 * sa.keys, sa.keys, 0 };
+
+    // Roomy tables plus a nearly full one that forces long probe clusters
+    size_t tsizes[] = { sa.keys * 2, sa.keys + sa.keys / 8 + 1 };
+
+    signal(SIGALRM, on_timeout);
+
+    for (size_t e = 0; e < NUM_ENGINES; e++) {
+        if (sa.engine && strcmp(sa.engine, g_engines[e].name) != 0) continue;
+        g_engine = &g_engines[e];
+        for (size_t t = 0; t < NUM_STRESS_THREADS; t++) {
+            size_t errors_before = g_errors;
+            struct timespec t0, t1;
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+
+            for (size_t s = 0; s < sizeof(tsizes) / sizeof(tsizes[0]); s++) {
+                for (int r = 0; r < sa.rounds; r++) {
+                    alarm(sa.timeout);
+                    if (g_engine->approximate) {
+                        // Filters answer "probably present" and cannot list their keys
+                        filter_round(&sa, stress_threads[t], tsizes[s], pool, meta, indices, results);
+                    } else {
+                        stress_round(&sa, stress_threads[t], tsizes[s], pool, meta, ids,
+                                     indices, results, oracle_t, engine_t, insert_slot,
+                                     &before, &after);
+                    }
+                    alarm(0);
+                }
+            }
+
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            printf("%-12s threads=%-3d %s (%.2fs)\n", g_engine->name, stress_threads[t],
+                   g_errors == errors_before ? "ok" : "FAILED", elapsed_seconds(&t0, &t1));
+            fflush(stdout);
+        }
+    }
+
+    oracle_reset(0);
+    free(pool);
+    free(meta);
+    free(ids);
+    free(indices);
+    free(results);
+    free(per_key);
+
+    if (g_errors) {
+        fprintf(stderr, "%zu invariant violations (seed 0x%llx)\n", g_errors,
+                (unsigned long long)sa.seed);
+        return 1;
+    }
+    printf("All engines passed\n");
+    return 0;
+}